@@ -0,0 +1,229 @@
+/*
+ * Byte ring buffer of length-prefixed data blocks
+ *
+ * Used by the kernel module for the frames sent by the stack, and built in
+ * user space by the ring buffer benchmark and fuzz harness in ../test.
+ * The caller takes care of the locking.
+ *
+ * Each block is an int holding the data size followed by the data, blocks
+ * and their size may wrap around the end of the buffer. Inserting into a
+ * full buffer evicts the oldest blocks.
+ */
+
+#ifndef WPANTAP_RINGBUF_H
+#define WPANTAP_RINGBUF_H
+
+#ifdef __KERNEL__
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/errno.h>
+
+#define ringbuf_alloc(size) kmalloc(size, GFP_KERNEL)
+#define ringbuf_free(ptr) kfree(ptr)
+// called from fakelb_hw_xmit for every frame, keep a flood from the log
+#define ringbuf_err(args...) pr_err_ratelimited(args)
+#define ringbuf_warn(args...) pr_warn_ratelimited(args)
+
+#else
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define ringbuf_alloc(size) malloc(size)
+#define ringbuf_free(ptr) free(ptr)
+// the fuzz harness defines these as no-ops before including this file
+#ifndef ringbuf_err
+#define ringbuf_err(args...) fprintf(stderr, args)
+#endif
+#ifndef ringbuf_warn
+#define ringbuf_warn(args...) fprintf(stderr, args)
+#endif
+
+#endif
+
+
+// the size of the ring buffer of the driver, it must hold at least the
+// longest frame (WPANTAP_FRAME_MAX) with its capture time and block size
+#define RINGBUF_SIZE 4096
+
+
+struct ringbuf_t
+{
+	char *buf;
+	char *head, *tail;
+	char *end;
+	int size;
+	int capacity;
+};
+
+
+// returns 0 if init is successful
+static inline int ringbuf_init(struct ringbuf_t *rb, int size)
+{
+	rb->buf = ringbuf_alloc(size);
+	if(rb->buf == NULL){
+		ringbuf_err("wpantap: unable to allocate %d bytes for ring buffer.\n", size);
+		return -ENOMEM;
+	}
+
+	rb->size = size;
+	rb->capacity = rb->size - 1;
+	rb->head = rb->tail = rb->buf;
+	rb->end = rb->buf + rb->size;
+
+	return 0;
+}
+
+
+static inline void ringbuf_deinit(struct ringbuf_t *rb)
+{
+	ringbuf_free(rb->buf);
+	rb->buf = rb->head = rb->tail = rb->end = NULL;
+	rb->size = rb->capacity = 0;
+}
+
+
+static inline int ringbuf_bytes_used(struct ringbuf_t *rb)
+{
+	if(rb->tail >= rb->head){
+		return rb->tail - rb->head;
+	}
+	else{
+		return rb->capacity - (rb->head - rb->tail - 1);
+	}
+}
+
+
+static inline int ringbuf_bytes_free(struct ringbuf_t *rb)
+{
+	return rb->capacity - ringbuf_bytes_used(rb);
+}
+
+
+static inline int ringbuf_is_empty(struct ringbuf_t *rb)
+{
+	return ringbuf_bytes_free(rb) == rb->capacity;
+}
+
+
+/*
+ * Given a ring buffer rb, a location and a offset to a location within its
+ * contiguous buffer, returns the logical location
+ */
+static inline char *ringbuf_ll(struct ringbuf_t *rb, char *anchor, int offset)
+{
+	return rb->buf + (((anchor - rb->buf) + offset) % rb->size);
+}
+
+
+// copies len bytes to the logical location anchor + offset,
+// in two pieces if they wrap around the end of the buffer
+static inline void ringbuf_write(struct ringbuf_t *rb, char *anchor, int offset, const void *data, int len)
+{
+	char *dst = ringbuf_ll(rb, anchor, offset);
+	int first = rb->end - dst;
+
+	if(first > len){
+		first = len;
+	}
+	memcpy(dst, data, first);
+	memcpy(rb->buf, (const char*)data + first, len - first);
+}
+
+
+// reverse of ringbuf_write
+static inline void ringbuf_read(struct ringbuf_t *rb, char *anchor, int offset, void *data, int len)
+{
+	char *src = ringbuf_ll(rb, anchor, offset);
+	int first = rb->end - src;
+
+	if(first > len){
+		first = len;
+	}
+	memcpy(data, src, first);
+	memcpy((char*)data + first, rb->buf, len - first);
+}
+
+
+static inline int ringbuf_get_first_data_size(struct ringbuf_t *rb)
+{
+	int size;
+
+	if (ringbuf_is_empty(rb) == 1){
+		ringbuf_err("wpantap: no data is avaliable in the buffer!\n");
+		return 0;
+	}
+
+	// the size itself may wrap around the end of the buffer
+	ringbuf_read(rb, rb->head, 0, &size, sizeof(int));
+	return size;
+}
+
+
+static inline int ringbuf_copy_first_data(struct ringbuf_t *rb, void *p)
+{
+	int size = ringbuf_get_first_data_size(rb);
+
+	if (size == 0){
+		ringbuf_err("wpantap: data copy failed!\n");
+		return 0;
+	}
+
+	ringbuf_read(rb, rb->head, sizeof(int), p, size);
+	return size;
+}
+
+
+// returns 0 if a data block is poped
+static inline int ringbuf_pop_data(struct ringbuf_t *rb)
+{
+	int size = ringbuf_get_first_data_size(rb);
+
+	if(size == 0){
+		return 1;
+	}
+
+	rb->head = ringbuf_ll(rb, rb->head, size + sizeof(int));
+	return 0;
+}
+
+
+// inserts one data block made of two segments (e.g. a header and a frame)
+// returns 0 if the insertion is successful
+static inline int ringbuf_insert_data2(struct ringbuf_t *rb, int size1, const void *data1, int size2, const void *data2)
+{
+	int size = size1 + size2;
+	int total_size = sizeof(int) + size;
+	char *rbtail = rb->tail;
+
+	if(size == 0){
+		ringbuf_warn("wpantap: trying to insert a buffer of size 0, discarded\n");
+		return 0;
+	}
+
+	if(total_size > rb->capacity){
+		ringbuf_err("wpantap: the total size of data (%d) is bigger than the capacity of ring buffer (%d)\n", total_size, rb->capacity);
+		return 1;
+	}
+
+	// pop data until there is enough space
+	while(total_size > ringbuf_bytes_free(rb)){
+		if (ringbuf_pop_data(rb) != 0){
+			ringbuf_err("wpantap: error while popping buffer for insertion\n");
+			return 1;
+		}
+	}
+
+	ringbuf_write(rb, rbtail, 0, &size, sizeof(int));
+	ringbuf_write(rb, rbtail, sizeof(int), data1, size1);
+	ringbuf_write(rb, rbtail, sizeof(int) + size1, data2, size2);
+
+	rb->tail = ringbuf_ll(rb, rbtail, total_size);
+	return 0;
+}
+
+#endif /* WPANTAP_RINGBUF_H */
@@ -5,6 +5,7 @@
  */
 
 #include <linux/module.h>
+#include <linux/version.h>
 #include <linux/timer.h>
 #include <linux/slab.h>
 #include <linux/platform_device.h>
@@ -14,8 +15,34 @@
 #include <linux/spinlock.h>
 #include <net/mac802154.h>
 #include <net/cfg802154.h>
+#include <net/ieee802154_netdev.h>
 #include <linux/poll.h>
 #include <linux/wait.h>
+#include <linux/hrtimer.h>
+#include <linux/interrupt.h>
+#include <linux/vmalloc.h>
+#include <linux/math64.h>
+#include <linux/rbtree.h>
+#include <linux/random.h>
+#include <linux/rcupdate.h>
+#include <linux/atomic.h>
+#include <linux/percpu.h>
+#include <linux/smp.h>
+#include <linux/cpumask.h>
+#include <linux/hashtable.h>
+#include <asm/unaligned.h>
+#include <linux/nsproxy.h>
+#include <linux/ip.h>
+#include <linux/udp.h>
+#include <net/route.h>
+#include <net/udp_tunnel.h>
+#include <net/net_namespace.h>
+#include <net/netns/generic.h>
+
+#include "wpantap.h"
+#include "ringbuf.h"
+#include "wpantap_skb.h"
+#include "wpantap_link.h"
 
 // Do not activate printk_dbg unless for debug purposes
 // This will create a large amount of log message which will exhaust
@@ -26,371 +53,1563 @@
 #define printk_dbg(args...) ;
 
 
-// ring buffer for temporary packet storage
-static DEFINE_SPINLOCK(ringbuf_spin);
-
-// the size of ring buffer (must be four-byte aligned!)
-#define RINGBUF_SIZE 2048
-
-// allocate buffer in kernel space safely
-// guarantees four-byte alignment
-static void* kmalloc_safe(int size){
-    int mult;
-    int total_size;
-    void *ptr;
-    
-    if(size < 0){
-        printk(KERN_ERR "wpantap: trying to allocate negative size!");
-        return NULL;
-    }else if(size == 0){
-        printk(KERN_ERR "wpantap: trying to allocate zero size!");
-        return NULL;
-    }
-    
-    // make sure the size is four-byte aligned
-    mult = size / 4;
-    total_size = mult * 4;
-    if (total_size < size){
-        total_size += 4;
-    }
-    
-    ptr = kmalloc(total_size, GFP_KERNEL);
-    if(ptr == NULL){
-        printk(KERN_ERR "wpantap: kmalloc_safe-unable to allocate %d bytes", total_size);
-    }
-    
-    return ptr;
-}
-
-
-struct ringbuf_t
+/*
+ * Frame buffers
+ *
+ * A frame taken off the ring buffer is copied, with its capture time, into
+ * a buffer of one of two slab caches: one sized for 802.15.4 frames and
+ * one for the longest SUN frame, so the common case does not pay for the
+ * rare one. The counters are per CPU and global to the module.
+ */
+#define WPANTAP_FRAME_BUF_SMALL (sizeof(u64) + IEEE802154_MTU)
+#define WPANTAP_FRAME_BUF_LARGE (sizeof(u64) + WPANTAP_FRAME_MAX)
+
+struct wpantap_alloc_pcpu {
+	u64 allocs;
+	u64 large_allocs;
+	u64 failures;
+	u64 frees;
+};
+
+static struct kmem_cache *wpantap_frame_small_cache;
+static struct kmem_cache *wpantap_frame_large_cache;
+static DEFINE_PER_CPU(struct wpantap_alloc_pcpu, wpantap_alloc_pcpu);
+
+static void *wpantap_frame_buf_alloc(int size, gfp_t gfp, struct kmem_cache **cache)
 {
+	struct kmem_cache *c = wpantap_frame_small_cache;
 	void *buf;
-	void *head, *tail;
-	void *end;
-	int size;
-	int capacity;
-};
 
+	if(WARN_ON_ONCE(size <= 0 || size > (int)WPANTAP_FRAME_BUF_LARGE)){
+		return NULL;
+	}
+	if(size > (int)WPANTAP_FRAME_BUF_SMALL){
+		c = wpantap_frame_large_cache;
+	}
+
+	buf = kmem_cache_alloc(c, gfp);
+	if(buf == NULL){
+		this_cpu_inc(wpantap_alloc_pcpu.failures);
+		return NULL;
+	}
 
-static struct ringbuf_t rbuf;
+	this_cpu_inc(wpantap_alloc_pcpu.allocs);
+	if(c == wpantap_frame_large_cache){
+		this_cpu_inc(wpantap_alloc_pcpu.large_allocs);
+	}
+	*cache = c;
+	return buf;
+}
 
-// returns 0 if init is successful
-static int ringbuf_init(struct ringbuf_t *rb)
+static void wpantap_frame_buf_free(struct kmem_cache *cache, void *buf)
 {
-	rb->buf = kmalloc_safe(RINGBUF_SIZE);
-	if(rb->buf == NULL){
-		printk(KERN_ERR "wpantap: unable to allocate %d bytes for ring buffer.\n", RINGBUF_SIZE);
-		return -ENOMEM;
+	if(buf == NULL){
+		return;
 	}
-	
-	rb->size = RINGBUF_SIZE;
-	rb->capacity = rb->size - 1;
-	rb->head = rb->tail = rb->buf;
-	rb->end = rb->buf + rb->size;
+	kmem_cache_free(cache, buf);
+	this_cpu_inc(wpantap_alloc_pcpu.frees);
+}
+
+static void wpantap_alloc_get_stats(struct wpantap_alloc_stats *stats)
+{
+	int cpu;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->small_size = WPANTAP_FRAME_BUF_SMALL;
+	stats->large_size = WPANTAP_FRAME_BUF_LARGE;
+	for_each_possible_cpu(cpu){
+		struct wpantap_alloc_pcpu *pcpu = per_cpu_ptr(&wpantap_alloc_pcpu, cpu);
+
+		stats->allocs += pcpu->allocs;
+		stats->large_allocs += pcpu->large_allocs;
+		stats->failures += pcpu->failures;
+		stats->in_use += pcpu->frees;
+	}
+	// frees were summed into in_use
+	stats->in_use = stats->allocs - stats->in_use;
+}
 
+static int wpantap_alloc_init(void)
+{
+	wpantap_frame_small_cache = kmem_cache_create("wpantap_frame", WPANTAP_FRAME_BUF_SMALL,
+						      sizeof(u64), 0, NULL);
+	if(wpantap_frame_small_cache == NULL){
+		return -ENOMEM;
+	}
+	wpantap_frame_large_cache = kmem_cache_create("wpantap_frame_sun", WPANTAP_FRAME_BUF_LARGE,
+						      sizeof(u64), 0, NULL);
+	if(wpantap_frame_large_cache == NULL){
+		kmem_cache_destroy(wpantap_frame_small_cache);
+		return -ENOMEM;
+	}
 	return 0;
 }
 
+static void wpantap_alloc_deinit(void)
+{
+	kmem_cache_destroy(wpantap_frame_large_cache);
+	kmem_cache_destroy(wpantap_frame_small_cache);
+}
+
+
+// read-only mirror subscriber, it owns a private queue of skb clones
+// so that monitoring tools never steal frames from the ring buffer
+struct wpantap_mirror {
+	struct sk_buff_head queue;
+	unsigned int depth;
+
+	// protected by the mirrors_spin of the instance
+	u64 frames;
+	u64 drops;
+
+	struct list_head list;
+};
+
+// per-fd state of the file system node
+struct wpantap_file {
+	// instance of the network namespace the fd was opened in
+	struct wpantap_net *wn;
+	struct wpantap_mirror *mirror;
+
+	// read format (WPANTAP_FMT_*)
+	unsigned int format;
+	// the pcapng headers have been read
+	bool pcapng_started;
+	// phy the written frames go to (WPANTAPSETPHY), empty is the first one up
+	char phy[WPANTAP_PHY_NAME_LEN];
+};
+
+
+// virtual time mode, the queue holds written frames ordered by delivery time
+struct wpantap_vtime {
+	spinlock_t spin;
+	bool enabled;
+	u64 now;
+	struct rb_root_cached queue;
+	u32 queued;
+};
+
+// a frame held back in virtual time keeps the name of its phy in skb->cb
+struct wpantap_vtime_cb {
+	char phy[WPANTAP_PHY_NAME_LEN];
+};
+#define WPANTAP_VTIME_CB(skb) ((struct wpantap_vtime_cb *)(skb)->cb)
+
+
+// kernel-side traffic replay, see WPANTAPREPLAYLOAD
+struct wpantap_replay {
+	// serializes load, start and stop
+	struct mutex lock;
+
+	// protects everything below against the tasklet
+	spinlock_t spin;
+	void *trace;
+	u32 len;
+	u32 pos;
+	u64 index;
+	bool running;
+	struct wpantap_replay_cfg cfg;
+	// phy selected on the fd that started the replay
+	char phy[WPANTAP_PHY_NAME_LEN];
+	u64 interval_ns;
+	ktime_t start;
+	ktime_t end;
+	struct wpantap_replay_stats stats;
+
+	struct hrtimer timer;
+	struct tasklet_struct tasklet;
+};
+
+
+// a flow of the fair queue, the frames of one source address
+struct wpantap_fq_flow {
+	u8 mode;
+	u16 pan;
+	u64 addr;
+
+	// protected by the spin of the fair queue
+	struct sk_buff_head queue;
+	int deficit;
+	u64 frames;
+	u64 bytes;
+	u64 drops;
+
+	struct hlist_node node;
+	// on the active list of the fair queue while the flow has frames,
+	// on its idle list otherwise
+	struct list_head list;
+};
+
+#define WPANTAP_FQ_HASH_BITS 6
+
+// deficit round robin over the source addresses, see WPANTAPSETFQ
+struct wpantap_fq {
+	spinlock_t spin;
+	bool enabled;
+	u32 quantum;
+	u32 depth;
+
+	DECLARE_HASHTABLE(flows, WPANTAP_FQ_HASH_BITS);
+	u32 nflows;
+	// backlogged flows in round robin order
+	struct list_head active;
+	// flows without frames, the one idle the longest first
+	struct list_head idle;
+	u32 queued;
+	u64 drops;
+};
+
+
+/*
+ * Network namespaces
+ *
+ * Every network namespace has its own instance of the driver: phys, ring
+ * buffer, fair queue, mirrors, virtual clock and replay. An fd belongs to the instance
+ * of the namespace it is opened in. A phy belongs to the instance that
+ * created it, even once it is moved to another namespace (lowpan_setup.sh
+ * moves the phy of the initial namespace).
+ *
+ * The initial namespace gets numlbs phys when the module is loaded. Other
+ * namespaces get theirs, created inside them, on the first open of the
+ * device from there; they go away with the namespace.
+ */
+struct wpantap_net {
+	struct net *net;
+
+	// ring buffer for temporary packet storage
+	struct ringbuf_t rbuf;
+	spinlock_t ringbuf_spin;
+
+	// readers sleep here until the ring buffer or their mirror queue has data
+	wait_queue_head_t wait;
+
+	struct list_head mirrors;
+	spinlock_t mirrors_spin;
+
+	struct wpantap_vtime vtime;
+	struct wpantap_replay replay;
+	struct wpantap_fq fq;
+
+	// protected by fakelb_phys_lock
+	struct list_head phys;
+	bool phys_added;
+	// protected by fakelb_ifup_phys_lock
+	struct list_head ifup_phys;
+};
+
+static unsigned int wpantap_net_id;
+
+static struct wpantap_net *wpantap_pernet(struct net *net)
+{
+	return net_generic(net, wpantap_net_id);
+}
+
 
-static void ringbuf_deinit(struct ringbuf_t *rb)
+// capture time of a transmitted frame: the virtual clock in virtual time mode
+static u64 wpantap_now(struct wpantap_net *wn)
 {
-	kfree(rb->buf);
-	rb->size = rb->capacity = 0;
+	if(READ_ONCE(wn->vtime.enabled)){
+		return READ_ONCE(wn->vtime.now);
+	}
+	return ktime_get_real_ns();
 }
 
 
-static int ringbuf_bytes_used(struct ringbuf_t *rb)
+// hands a clone of a transmitted frame to every mirror, never blocks
+static void wpantap_mirror_feed(struct wpantap_net *wn, struct sk_buff *skb, u64 tstamp)
 {
-	if(rb->tail >= rb->head){
-		return rb->tail - rb->head;
+	struct wpantap_mirror *mirror;
+	struct sk_buff *clone;
+
+	if(list_empty(&wn->mirrors)){
+		return;
 	}
-	else{
-		return rb->capacity - (rb->head - rb->tail - 1);
+
+	spin_lock_bh(&wn->mirrors_spin);
+	list_for_each_entry(mirror, &wn->mirrors, list) {
+		// a slow monitor only loses its own frames
+		if(skb_queue_len(&mirror->queue) >= mirror->depth){
+			mirror->drops++;
+			continue;
+		}
+
+		// the clone shares the frame data with skb, nothing is copied
+		clone = skb_clone(skb, GFP_ATOMIC);
+		if(clone == NULL){
+			mirror->drops++;
+			continue;
+		}
+
+		clone->tstamp = ns_to_ktime(tstamp);
+		skb_queue_tail(&mirror->queue, clone);
+		mirror->frames++;
 	}
+	spin_unlock_bh(&wn->mirrors_spin);
 }
 
 
-static int ringbuf_bytes_free(struct ringbuf_t *rb)
+// returns 0 if the fd is attached as a mirror
+static int wpantap_mirror_attach(struct wpantap_file *tfile, unsigned int depth)
 {
-	return rb->capacity - ringbuf_bytes_used(rb);
+	struct wpantap_mirror *mirror;
+
+	if(depth == 0){
+		depth = WPANTAP_MIRROR_DEPTH_DEFAULT;
+	}else if(depth > WPANTAP_MIRROR_DEPTH_MAX){
+		return -EINVAL;
+	}
+
+	mirror = kzalloc(sizeof(*mirror), GFP_KERNEL);
+	if(mirror == NULL){
+		printk(KERN_ERR "wpantap: unable to allocate mirror\n");
+		return -ENOMEM;
+	}
+
+	skb_queue_head_init(&mirror->queue);
+	mirror->depth = depth;
+
+	// an fd can only be attached once
+	if(cmpxchg(&tfile->mirror, NULL, mirror) != NULL){
+		kfree(mirror);
+		return -EBUSY;
+	}
+
+	spin_lock_bh(&tfile->wn->mirrors_spin);
+	list_add_tail(&mirror->list, &tfile->wn->mirrors);
+	spin_unlock_bh(&tfile->wn->mirrors_spin);
+
+	printk_dbg(KERN_DEBUG "wpantap: mirror attached with depth %u\n", depth);
+	return 0;
 }
 
 
-static int ringbuf_is_empty(struct ringbuf_t *rb)
+static void wpantap_mirror_detach(struct wpantap_net *wn, struct wpantap_mirror *mirror)
 {
-	return ringbuf_bytes_free(rb) == rb->capacity;
+	spin_lock_bh(&wn->mirrors_spin);
+	list_del(&mirror->list);
+	spin_unlock_bh(&wn->mirrors_spin);
+
+	skb_queue_purge(&mirror->queue);
+	kfree(mirror);
 }
 
 
-/*
- * Given a ring buffer rb, a location and a offset to a location within its
- * contiguous buffer, returns the logical location
- */
-static void *ringbuf_ll(struct ringbuf_t *rb, void *anchor, int offset)
+static void wpantap_mirror_get_stats(struct wpantap_net *wn, struct wpantap_mirror *mirror, struct wpantap_mirror_stats *stats)
 {
-	return rb->buf + (((anchor - rb->buf) + offset) % rb->size);
+	spin_lock_bh(&wn->mirrors_spin);
+	stats->depth = mirror->depth;
+	stats->queued = skb_queue_len(&mirror->queue);
+	stats->frames = mirror->frames;
+	stats->drops = mirror->drops;
+	spin_unlock_bh(&wn->mirrors_spin);
 }
 
-static int ringbuf_get_first_data_size(struct ringbuf_t *rb)
+
+// reads the source address of a frame, flows of malformed frames and of
+// frames without source address have mode WPANTAP_FQ_ADDR_NONE
+static void wpantap_fq_parse(const u8 *f, unsigned int len, u8 *mode, u16 *pan, u64 *addr)
 {
-	int *size;
-	if (ringbuf_is_empty(rb) == 1){
-		printk(KERN_ERR "wpantap: no data is avaliable in the buffer!\n");
-		return 0;
+	u16 fc, dst_pan = 0;
+	u8 dst_mode, src_mode;
+	unsigned int pos = 2;
+
+	*mode = WPANTAP_FQ_ADDR_NONE;
+	*pan = 0;
+	*addr = 0;
+	if(len < 3){
+		return;
+	}
+
+	fc = get_unaligned_le16(f);
+	dst_mode = (fc >> 10) & 3;
+	src_mode = (fc >> 14) & 3;
+	if(src_mode == WPANTAP_FQ_ADDR_NONE || src_mode == 1 || dst_mode == 1){
+		return;
+	}
+
+	// no sequence number with sequence number suppression (2015)
+	if(((fc >> 12) & 3) != 2 || !(fc & (1 << 8))){
+		pos++;
+	}
+	if(dst_mode != WPANTAP_FQ_ADDR_NONE){
+		if(pos + 2 > len){
+			return;
+		}
+		dst_pan = get_unaligned_le16(f + pos);
+		pos += 2 + (dst_mode == WPANTAP_FQ_ADDR_SHORT ? 2 : 8);
+	}
+
+	// PAN ID compression, with the 2003/2006 rules
+	if((fc & (1 << 6)) && dst_mode != WPANTAP_FQ_ADDR_NONE){
+		*pan = dst_pan;
+	}else{
+		if(pos + 2 > len){
+			return;
+		}
+		*pan = get_unaligned_le16(f + pos);
+		pos += 2;
+	}
+
+	if(src_mode == WPANTAP_FQ_ADDR_SHORT){
+		if(pos + 2 > len){
+			return;
+		}
+		*addr = get_unaligned_le16(f + pos);
+	}else{
+		if(pos + 8 > len){
+			return;
+		}
+		*addr = get_unaligned_le64(f + pos);
+		// an extended address is unique, whatever the PAN
+		*pan = 0;
 	}
-	size = (int*)rb->head;
-	return *size;
+	*mode = src_mode;
 }
 
 
-static int ringbuf_copy_first_data(struct ringbuf_t *rb, void *p)
+static u32 wpantap_fq_hash(u8 mode, u16 pan, u64 addr)
 {
-	int i;
-	int size = ringbuf_get_first_data_size(rb);
-	char *cp = (char*)p;
-	
-	printk_dbg(KERN_DEBUG "wpantap: copying data from ring buf\n");
-	
-	if (size == 0){
-		printk(KERN_ERR "wpantap: data copy failed!\n");
-		return 0;
+	return hash_64(addr ^ ((u64)pan << 32) ^ ((u64)mode << 62), WPANTAP_FQ_HASH_BITS);
+}
+
+
+// returns the flow of a source address, creating it if needed
+// once there are WPANTAP_FQ_FLOWS_MAX flows, the flow idle the longest is
+// taken over, NULL is returned only if every flow has frames queued
+// called with the spin of the fair queue held
+static struct wpantap_fq_flow *wpantap_fq_flow(struct wpantap_fq *fq, u8 mode, u16 pan, u64 addr)
+{
+	struct wpantap_fq_flow *flow;
+	u32 hash = wpantap_fq_hash(mode, pan, addr);
+
+	hash_for_each_possible(fq->flows, flow, node, hash) {
+		if(flow->mode == mode && flow->pan == pan && flow->addr == addr){
+			return flow;
+		}
 	}
-	
-	/*
-	printk_dbg(KERN_DEBUG "first bytes: %02x %02x %02x %02x\n",
-		*(char*)ringbuf_ll(rb, rb->head, sizeof(int)),
-		*(char*)ringbuf_ll(rb, rb->head, sizeof(int) + 1),
-		*(char*)ringbuf_ll(rb, rb->head, sizeof(int) + 2),
-		*(char*)ringbuf_ll(rb, rb->head, sizeof(int) + 3));
-	*/
 
-	for(i = 0; i < size; ++i){
-		cp[i] = *(char*)ringbuf_ll(rb, rb->head, i + sizeof(int));
+	if(fq->nflows >= WPANTAP_FQ_FLOWS_MAX){
+		if(list_empty(&fq->idle)){
+			return NULL;
+		}
+		// the node left or went quiet, its counters go with it
+		flow = list_first_entry(&fq->idle, struct wpantap_fq_flow, list);
+		hash_del(&flow->node);
+		flow->frames = 0;
+		flow->bytes = 0;
+		flow->drops = 0;
+	}else{
+		flow = kzalloc(sizeof(*flow), GFP_ATOMIC);
+		if(flow == NULL){
+			return NULL;
+		}
+		__skb_queue_head_init(&flow->queue);
+		list_add_tail(&flow->list, &fq->idle);
+		fq->nflows++;
+	}
+	flow->mode = mode;
+	flow->pan = pan;
+	flow->addr = addr;
+	hash_add(fq->flows, &flow->node, hash);
+	return flow;
+}
+
+
+// queues a clone of a transmitted frame on the flow of its source address
+// returns false if fair queueing is off, the frame then goes to the ring buffer
+static bool wpantap_fq_enqueue(struct wpantap_net *wn, struct sk_buff *skb, u64 tstamp)
+{
+	struct wpantap_fq *fq = &wn->fq;
+	struct wpantap_fq_flow *flow;
+	struct sk_buff *clone;
+	u64 addr;
+	u16 pan;
+	u8 mode;
+
+	if(!READ_ONCE(fq->enabled)){
+		return false;
 	}
-	
-	return size;
+
+	wpantap_fq_parse(skb->data, skb_headlen(skb), &mode, &pan, &addr);
+
+	spin_lock_bh(&fq->spin);
+	if(!fq->enabled){
+		spin_unlock_bh(&fq->spin);
+		return false;
+	}
+
+	flow = wpantap_fq_flow(fq, mode, pan, addr);
+	if(flow == NULL){
+		fq->drops++;
+		goto out;
+	}
+	if(skb_queue_len(&flow->queue) >= fq->depth){
+		flow->drops++;
+		goto out;
+	}
+	clone = skb_clone(skb, GFP_ATOMIC);
+	if(clone == NULL){
+		flow->drops++;
+		goto out;
+	}
+
+	clone->tstamp = ns_to_ktime(tstamp);
+	__skb_queue_tail(&flow->queue, clone);
+	flow->frames++;
+	flow->bytes += clone->len;
+	fq->queued++;
+	// a flow joins the end of the round with no credit
+	if(skb_queue_len(&flow->queue) == 1){
+		flow->deficit = 0;
+		list_move_tail(&flow->list, &fq->active);
+	}
+
+out:
+	spin_unlock_bh(&fq->spin);
+	return true;
 }
 
-static void print_ringbuf_stat(void)
+
+// drops every flow and its frames, called with the spin held
+static void wpantap_fq_purge(struct wpantap_fq *fq)
 {
-	struct ringbuf_t *rb = &rbuf;
-	size_t htdist = rb->tail - rb->head;
-	printk_dbg(KERN_DEBUG "wpantap: ringbuf stat h:%lu t:%lu d:%lu u:%lu f:%lu c:%d\n",
-		(size_t)rb->head,
-		(size_t)rb->tail,
-		htdist,
-		(size_t)ringbuf_bytes_used(rb),
-		(size_t)ringbuf_bytes_free(rb),
-		rb->capacity);
+	struct wpantap_fq_flow *flow;
+	struct hlist_node *tmp;
+	int bkt;
+
+	hash_for_each_safe(fq->flows, bkt, tmp, flow, node) {
+		__skb_queue_purge(&flow->queue);
+		hash_del(&flow->node);
+		kfree(flow);
+	}
+	INIT_LIST_HEAD(&fq->active);
+	INIT_LIST_HEAD(&fq->idle);
+	fq->nflows = 0;
+	fq->queued = 0;
+	fq->drops = 0;
 }
 
 
-// returns 0 if a data block is poped
-static int ringbuf_pop_data(struct ringbuf_t *rb)
-{	
-	int size = ringbuf_get_first_data_size(rb);
-	int total_size;
-	
-	printk_dbg(KERN_DEBUG "wpantap: popping data from ring buffer...\n");
-	print_ringbuf_stat();
+static int wpantap_fq_set(struct wpantap_net *wn, struct wpantap_fq_cfg *cfg)
+{
+	struct wpantap_fq *fq = &wn->fq;
+	u32 quantum = cfg->quantum ? cfg->quantum : WPANTAP_FQ_QUANTUM_DEFAULT;
+	u32 depth = cfg->depth ? cfg->depth : WPANTAP_FQ_DEPTH_DEFAULT;
 
-	if(size == 0){
-		return 1;
+	if(quantum < WPANTAP_FQ_QUANTUM_MIN || depth > WPANTAP_FQ_DEPTH_MAX){
+		return -EINVAL;
 	}
-	
-	// find the length of current buffer
-	total_size = size + sizeof(int);
-	
-	rb->head = ringbuf_ll(rb, rb->head, total_size);
-	print_ringbuf_stat();
 
+	spin_lock_bh(&fq->spin);
+	if(!cfg->enabled){
+		wpantap_fq_purge(fq);
+	}
+	// a smaller depth lets the longer flows drain
+	fq->quantum = quantum;
+	fq->depth = depth;
+	WRITE_ONCE(fq->enabled, cfg->enabled != 0);
+	spin_unlock_bh(&fq->spin);
 	return 0;
 }
 
 
-// returns 0 if the insertion is successful
-static int ringbuf_insert_data(struct ringbuf_t *rb, int size, void *data)
+static int wpantap_fq_get_stats(struct wpantap_net *wn, struct wpantap_fq_stats *stats)
 {
-	int total_size;
-	char *cdata;
-	char *rbdata;
-	void *rbtail;
-	char *temp;
-	int i;
-	
-	if(size == 0){
-		printk(KERN_WARNING "wpantap: trying to insert a buffer of size 0, discarded\n");
-		return 0;
+	struct wpantap_fq *fq = &wn->fq;
+	struct wpantap_fq_flow_stats *flows = NULL;
+	struct wpantap_fq_flow *flow;
+	u32 max = min_t(u32, stats->max_flows, WPANTAP_FQ_FLOWS_MAX);
+	u32 n = 0;
+	int bkt, err = 0;
+
+	if(max > 0){
+		flows = kcalloc(max, sizeof(*flows), GFP_KERNEL);
+		if(flows == NULL){
+			return -ENOMEM;
+		}
 	}
 
-	cdata = (char*)data;
-	total_size = sizeof(int) + size;
-	rbtail = rb->tail;
-	
-	
-	printk_dbg(KERN_DEBUG "wpantap: inserting data (%d) into ring buffer...\n", size);
-	print_ringbuf_stat();
-
-	if(total_size > rb->capacity){
-		printk(KERN_ERR "wpantap: the total size of data (%d) is bigger than the capacity of ring buffer (%d)\n", total_size, rb->capacity);
-		return 1;
-	}
-
-	// check bytes free
-	if(total_size > ringbuf_bytes_free(rb)){
-		// pop data until there is enough space
-		while(total_size > ringbuf_bytes_free(rb)){
-			i = ringbuf_pop_data(rb);
-			if (i != 0){
-				printk(KERN_ERR "wpantap: error while popping buffer for insertion\n");
-				return 1;
-			}
+	spin_lock_bh(&fq->spin);
+	stats->nflows = fq->nflows;
+	stats->enabled = fq->enabled;
+	stats->quantum = fq->quantum;
+	stats->depth = fq->depth;
+	stats->queued = fq->queued;
+	stats->drops = fq->drops;
+	hash_for_each(fq->flows, bkt, flow, node) {
+		if(n == max){
+			break;
 		}
+		flows[n].addr = flow->addr;
+		flows[n].pan = flow->pan;
+		flows[n].mode = flow->mode;
+		flows[n].queued = skb_queue_len(&flow->queue);
+		flows[n].frames = flow->frames;
+		flows[n].bytes = flow->bytes;
+		flows[n].drops = flow->drops;
+		n++;
 	}
+	spin_unlock_bh(&fq->spin);
 
-	// insert data into the ring buffer
-	temp = (char*)&size;
-	
-	for(i = 0; i < sizeof(int); ++i){
-		rbdata = (char*)ringbuf_ll(rb, rbtail, i);
-		*rbdata = temp[i];
+	if(n > 0 && copy_to_user(u64_to_user_ptr(stats->flows), flows, n * sizeof(*flows))){
+		err = -EFAULT;
 	}
+	kfree(flows);
+	return err;
+}
 
-	for(i = 0; i < size; ++i){
-		rbdata = (char*)ringbuf_ll(rb, rbtail, i + sizeof(int));
-		*rbdata = cdata[i];
-	}
 
-	// modify tail
-	rb->tail = (void*)rbdata + 1;
-	print_ringbuf_stat();	
+static void wpantap_fq_init(struct wpantap_fq *fq)
+{
+	spin_lock_init(&fq->spin);
+	fq->enabled = false;
+	fq->quantum = WPANTAP_FQ_QUANTUM_DEFAULT;
+	fq->depth = WPANTAP_FQ_DEPTH_DEFAULT;
+	hash_init(fq->flows);
+	INIT_LIST_HEAD(&fq->active);
+	INIT_LIST_HEAD(&fq->idle);
+	fq->nflows = 0;
+	fq->queued = 0;
+	fq->drops = 0;
+}
 
-	return 0;
+
+static void wpantap_fq_deinit(struct wpantap_fq *fq)
+{
+	spin_lock_bh(&fq->spin);
+	fq->enabled = false;
+	wpantap_fq_purge(fq);
+	spin_unlock_bh(&fq->spin);
 }
 
 
 
-// only create one device
+// phys created in each network namespace
 static int numlbs = 1;
 
-static LIST_HEAD(fakelb_phys);
+// protect the phys and ifup_phys lists of every instance
 static DEFINE_MUTEX(fakelb_phys_lock);
-
-static LIST_HEAD(fakelb_ifup_phys);
 static DEFINE_RWLOCK(fakelb_ifup_phys_lock);
 
+// link emulation state of a phy, see WPANTAPSETLINK
+struct wpantap_link {
+	spinlock_t spin;
+	bool enabled;
+	// set by wpantap_link_flush until the interface is up again, the
+	// timer is not armed while it is set
+	bool stopping;
+	u32 loss_ppm;
+	u32 delay_us;
+	u32 jitter_us;
+	u32 flags;
+
+	// the medium is busy until then
+	ktime_t busy_until;
+	ktime_t last_due;
+	// frames waiting for delivery, skb->tstamp is their due time
+	struct sk_buff_head queue;
+
+	u64 delivered;
+	u64 lost;
+	u64 drops;
+
+	struct hrtimer timer;
+	struct tasklet_struct tasklet;
+};
+
+// frames waiting to be handed to the stack, drained by a tasklet
+struct wpantap_inject {
+	// queue.lock also protects the counters
+	struct sk_buff_head queue;
+	struct tasklet_struct tasklet;
+
+	u64 drops;
+
+	// CPU the tasklet is scheduled on, WPANTAP_CPU_ANY for the caller's
+	int cpu;
+	// the IPI scheduling the tasklet on cpu, kicking is set while in flight
+	call_single_data_t csd;
+	atomic_t kicking;
+	// CPU of the last tasklet run
+	int last_cpu;
+};
+
+// in-kernel UDP tunnel of a phy, replaced as a whole under RCU
+struct wpantap_tunnel {
+	struct fakelb_phy *phy;
+	struct socket *sock;
+	// namespace of the instance of the phy, which removes the tunnel
+	// before it goes away, so no reference is held
+	struct net *net;
+	__be16 port;
+	u32 flags;
+	int nremotes;
+	struct sockaddr_in remotes[WPANTAP_TUNNEL_REMOTES_MAX];
+
+	atomic64_t tx_frames;
+	atomic64_t tx_errors;
+	atomic64_t rx_frames;
+	atomic64_t rx_errors;
+};
+
 struct fakelb_phy {
 	struct ieee802154_hw *hw;
+	// the instance that created the phy
+	struct wpantap_net *wn;
 
 	u8 page;
 	u8 channel;
 
 	bool suspended;
 
+	struct wpantap_inject inject;
+	struct wpantap_link link;
+	struct wpantap_tunnel __rcu *tunnel;
+
 	struct list_head list;
 	struct list_head list_ifup;
 };
 
-static int fakelb_hw_ed(struct ieee802154_hw *hw, u8 *level)
-{
-	WARN_ON(!level);
-	*level = 0xbe;
 
-	return 0;
-}
+/*
+ * Injection
+ *
+ * The injection queue of a phy lets its frames change CPU. Like RPS, a phy
+ * may have a preferred CPU (WPANTAPSETCPU): frames handed to the phy
+ * (write, replay, tunnel, link emulation) are queued and a tasklet is
+ * scheduled on that CPU with an IPI. It hands up to WPANTAP_INJECT_BUDGET
+ * frames per run to ieee802154_rx_irqsafe, which schedules the mac802154
+ * tasklet on the same CPU, so mac802154, 6LoWPAN and the socket wakeups of
+ * the simulated node stay on the CPU (and NUMA node) of its application,
+ * whatever CPU the writer runs on.
+ *
+ * Without a preferred CPU the tasklet runs on the CPU of the writer, one
+ * hop before the queue of mac802154. Frames beyond WPANTAP_INJECT_QUEUE_MAX
+ * are dropped and counted, see WPANTAPGETCPU.
+ */
+#define WPANTAP_INJECT_BUDGET 64
+#define WPANTAP_LQI 0xcc
 
-static int fakelb_hw_channel(struct ieee802154_hw *hw, u8 page, u8 channel)
+
+// runs on the preferred CPU in hard irq context
+static void wpantap_inject_ipi(void *data)
 {
-	struct fakelb_phy *phy = hw->priv;
+	struct wpantap_inject *inj = data;
 
-	write_lock_bh(&fakelb_ifup_phys_lock);
-	phy->page = page;
-	phy->channel = channel;
-	write_unlock_bh(&fakelb_ifup_phys_lock);
-	return 0;
+	// frames queued from now on send another IPI, the tasklet takes
+	// the ones queued before
+	atomic_set(&inj->kicking, 0);
+	tasklet_schedule(&inj->tasklet);
 }
 
-static int fakelb_hw_xmit(struct ieee802154_hw *hw, struct sk_buff *skb)
+
+// schedules the tasklet on the preferred CPU
+static void wpantap_inject_kick(struct wpantap_inject *inj)
 {
-	struct fakelb_phy *current_phy = hw->priv;
-	int head_len;
+	int cpu = READ_ONCE(inj->cpu);
+	int this_cpu = get_cpu();
+
+	if(cpu == WPANTAP_CPU_ANY || cpu == this_cpu || !cpu_online(cpu)){
+		tasklet_schedule(&inj->tasklet);
+	}else if(atomic_xchg(&inj->kicking, 1) == 0){
+		// the CPU went offline in between
+		if(smp_call_function_single_async(cpu, &inj->csd) != 0){
+			atomic_set(&inj->kicking, 0);
+			tasklet_schedule(&inj->tasklet);
+		}
+	}
+	put_cpu();
+}
 
-	read_lock_bh(&fakelb_ifup_phys_lock);
-	WARN_ON(current_phy->suspended);
-	
-	
-	printk_dbg(KERN_DEBUG "wpantap: sending packet with WPAN device...\n");
-	printk_dbg(KERN_DEBUG "wpantap: skb len:%d data_len %d\n", skb->len, skb->data_len);
-	//printk(KERN_DEBUG "first bytes: %02x %02x %02x %02x\n", (char*)skb->data[0], (char*)skb->data[1], (char*)skb->data[2], (char*)skb->data[3]);
 
-	head_len = skb->len - skb->data_len;
-    	spin_lock_bh(&ringbuf_spin);
-	ringbuf_insert_data(&rbuf, skb->len, skb->data);
-	spin_unlock_bh(&ringbuf_spin);
-	
-	read_unlock_bh(&fakelb_ifup_phys_lock);
+// queues frames (with FCS) for delivery to phy, consumes them
+static void wpantap_inject_list(struct fakelb_phy *phy, struct sk_buff_head *list)
+{
+	struct wpantap_inject *inj = &phy->inject;
+	u32 room;
+
+	spin_lock_bh(&inj->queue.lock);
+	room = WPANTAP_INJECT_QUEUE_MAX - min_t(u32, skb_queue_len(&inj->queue), WPANTAP_INJECT_QUEUE_MAX);
+	while(skb_queue_len(list) > room){
+		kfree_skb(__skb_dequeue_tail(list));
+		inj->drops++;
+	}
+	skb_queue_splice_tail_init(list, &inj->queue);
+	spin_unlock_bh(&inj->queue.lock);
 
-	ieee802154_xmit_complete(hw, skb, false);
-	return 0;
+	wpantap_inject_kick(inj);
 }
 
-static int fakelb_hw_start(struct ieee802154_hw *hw)
-{
-	struct fakelb_phy *phy = hw->priv;
 
-	write_lock_bh(&fakelb_ifup_phys_lock);
-	phy->suspended = false;
-	list_add(&phy->list_ifup, &fakelb_ifup_phys);
-	write_unlock_bh(&fakelb_ifup_phys_lock);
+static void wpantap_inject(struct fakelb_phy *phy, struct sk_buff *skb)
+{
+	struct sk_buff_head list;
 
-	return 0;
+	__skb_queue_head_init(&list);
+	__skb_queue_tail(&list, skb);
+	wpantap_inject_list(phy, &list);
 }
 
-static void fakelb_hw_stop(struct ieee802154_hw *hw)
+
+static void wpantap_inject_poll(unsigned long data)
 {
-	struct fakelb_phy *phy = hw->priv;
+	struct fakelb_phy *phy = (struct fakelb_phy *)data;
+	struct wpantap_inject *inj = &phy->inject;
+	struct sk_buff_head batch;
+	struct sk_buff *skb;
+	int budget = WPANTAP_INJECT_BUDGET;
+	bool more;
+
+	__skb_queue_head_init(&batch);
+	WRITE_ONCE(inj->last_cpu, smp_processor_id());
+
+	spin_lock(&inj->queue.lock);
+	while(budget-- > 0 && (skb = __skb_dequeue(&inj->queue)) != NULL){
+		__skb_queue_tail(&batch, skb);
+	}
+	more = !skb_queue_empty(&inj->queue);
+	spin_unlock(&inj->queue.lock);
+
+	read_lock(&fakelb_ifup_phys_lock);
+	while((skb = __skb_dequeue(&batch)) != NULL){
+		if(phy->suspended){
+			kfree_skb(skb);
+			continue;
+		}
+		ieee802154_rx_irqsafe(phy->hw, skb, WPANTAP_LQI);
+	}
+	read_unlock(&fakelb_ifup_phys_lock);
 
-	write_lock_bh(&fakelb_ifup_phys_lock);
-	phy->suspended = true;
-	list_del(&phy->list_ifup);
-	write_unlock_bh(&fakelb_ifup_phys_lock);
+	// the budget ran out, let other softirqs run first
+	if(more){
+		tasklet_schedule(&inj->tasklet);
+	}
 }
 
-static int
-fakelb_set_promiscuous_mode(struct ieee802154_hw *hw, const bool on)
+
+// drops every frame still waiting for delivery
+static void wpantap_inject_flush(struct wpantap_inject *inj)
 {
-	return 0;
+	// an IPI in flight would schedule the tasklet again
+	while(atomic_read(&inj->kicking)){
+		cpu_relax();
+	}
+	tasklet_kill(&inj->tasklet);
+	skb_queue_purge(&inj->queue);
 }
 
-static const struct ieee802154_ops fakelb_ops = {
-	.owner = THIS_MODULE,
-	.xmit_async = fakelb_hw_xmit,
-	.ed = fakelb_hw_ed,
-	.set_channel = fakelb_hw_channel,
-	.start = fakelb_hw_start,
-	.stop = fakelb_hw_stop,
-	.set_promiscuous_mode = fakelb_set_promiscuous_mode,
-};
-
-/* Number of dummy devices to be set up by this module. 
-   This parameter is suppressed.
-*/
-//module_param(numlbs, int, 0);
-//MODULE_PARM_DESC(numlbs, " number of pseudo devices");
 
-static int fakelb_add_one(struct device *dev)
+static void wpantap_inject_init(struct fakelb_phy *phy)
 {
-	struct ieee802154_hw *hw;
-	struct fakelb_phy *phy;
-	int err;
+	struct wpantap_inject *inj = &phy->inject;
+
+	skb_queue_head_init(&inj->queue);
+	tasklet_init(&inj->tasklet, wpantap_inject_poll, (unsigned long)phy);
+	inj->cpu = WPANTAP_CPU_ANY;
+	inj->csd.func = wpantap_inject_ipi;
+	inj->csd.info = inj;
+	atomic_set(&inj->kicking, 0);
+	inj->last_cpu = WPANTAP_CPU_ANY;
+}
 
-	hw = ieee802154_alloc_hw(sizeof(*phy), &fakelb_ops);
-	if (!hw)
-		return -ENOMEM;
 
-	phy = hw->priv;
-	phy->hw = hw;
+/*
+ * Link emulation
+ *
+ * Frames injected into a phy with a link profile wait in its FIFO until
+ * they are due. An hrtimer armed for the head of the queue kicks a tasklet
+ * that delivers every due frame in one batch; the timer slack lets close
+ * deadlines (and the links of many phys) share a single expiry.
+ */
+#define WPANTAP_LINK_SLACK_NS 50000
+// preamble, SFD and PHR in front of every PSDU
+#define WPANTAP_PHY_OVERHEAD 6
+
+// prandom_u32_max was replaced by get_random_u32_below in 6.2
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 2, 0)
+#define get_random_u32_below(ceil) prandom_u32_max(ceil)
+#endif
+
+// PHY bitrate of a page and channel in bit/s
+static u32 wpantap_phy_bitrate(u8 page, u8 channel)
+{
+	switch(page){
+	case 0:
+		if(channel == 0){
+			return 20000;	// 868 MHz BPSK
+		}else if(channel <= 10){
+			return 40000;	// 915 MHz BPSK
+		}
+		return 250000;		// 2.4 GHz O-QPSK
+	case 1:
+		return 250000;		// 868/915 MHz ASK
+	case 2:
+		return channel == 0 ? 100000 : 250000;	// 868/915 MHz O-QPSK
+	case 3:
+		return 250000;		// 2.4 GHz CSS
+	case 4:
+		return 850000;		// UWB
+	case 5:
+		return 250000;		// 780 MHz O-QPSK and MPSK
+	case 6:
+		return channel < 10 ? 20000 : 100000;	// 950 MHz BPSK and GFSK
+	default:
+		return 250000;
+	}
+}
+
+
+// queues an injected frame on the link of phy, consumes skb
+// called with fakelb_ifup_phys_lock held for reading
+static void wpantap_link_rx(struct fakelb_phy *phy, struct sk_buff *skb)
+{
+	struct wpantap_link *link = &phy->link;
+	ktime_t now, due;
+	u64 airtime = 0;
+	u32 bitrate, jitter = 0;
+
+	if(!READ_ONCE(link->enabled)){
+		wpantap_inject(phy, skb);
+		return;
+	}
+
+	spin_lock_bh(&link->spin);
+
+	if(link->loss_ppm != 0 && get_random_u32_below(1000000) < link->loss_ppm){
+		link->lost++;
+		spin_unlock_bh(&link->spin);
+		kfree_skb(skb);
+		return;
+	}
+
+	if(link->stopping || skb_queue_len(&link->queue) >= WPANTAP_LINK_QUEUE_MAX){
+		link->drops++;
+		spin_unlock_bh(&link->spin);
+		kfree_skb(skb);
+		return;
+	}
+
+	now = ktime_get();
+
+	if(link->flags & WPANTAP_LINK_AIRTIME){
+		bitrate = wpantap_phy_bitrate(phy->page, phy->channel);
+		airtime = div_u64((u64)(skb->len + WPANTAP_PHY_OVERHEAD) * 8 * NSEC_PER_SEC, bitrate);
+	}
+
+	if(link->jitter_us != 0){
+		jitter = get_random_u32_below(link->jitter_us + 1);
+	}
+	due = wpantap_link_due(now, airtime, (u64)link->delay_us * NSEC_PER_USEC,
+			       (u64)jitter * NSEC_PER_USEC, &link->busy_until, &link->last_due);
+
+	skb->tstamp = due;
+	__skb_queue_tail(&link->queue, skb);
+
+	// otherwise the timer is already armed for an earlier frame
+	if(skb_queue_len(&link->queue) == 1){
+		hrtimer_start_range_ns(&link->timer, due, WPANTAP_LINK_SLACK_NS, HRTIMER_MODE_ABS);
+	}
+
+	spin_unlock_bh(&link->spin);
+}
+
+
+static void wpantap_link_run(unsigned long data)
+{
+	struct fakelb_phy *phy = (struct fakelb_phy *)data;
+	struct wpantap_link *link = &phy->link;
+	struct sk_buff_head due;
+	struct sk_buff *skb;
+	ktime_t now = ktime_get();
+
+	__skb_queue_head_init(&due);
+
+	spin_lock(&link->spin);
+
+	while((skb = skb_peek(&link->queue)) != NULL){
+		if(ktime_after(skb->tstamp, now)){
+			if(!link->stopping){
+				hrtimer_start_range_ns(&link->timer, skb->tstamp, WPANTAP_LINK_SLACK_NS, HRTIMER_MODE_ABS);
+			}
+			break;
+		}
+		__skb_unlink(skb, &link->queue);
+		__skb_queue_tail(&due, skb);
+		link->delivered++;
+	}
+
+	spin_unlock(&link->spin);
+
+	skb_queue_walk(&due, skb) {
+		skb->tstamp = 0;
+	}
+	// hand the whole batch over
+	if(!skb_queue_empty(&due)){
+		wpantap_inject_list(phy, &due);
+	}
+}
+
+
+static enum hrtimer_restart wpantap_link_timer(struct hrtimer *timer)
+{
+	struct wpantap_link *link = container_of(timer, struct wpantap_link, timer);
+
+	tasklet_schedule(&link->tasklet);
+	return HRTIMER_NORESTART;
+}
+
+
+// drops every frame still waiting on the link
+static void wpantap_link_flush(struct wpantap_link *link)
+{
+	spin_lock_bh(&link->spin);
+	link->stopping = true;
+	spin_unlock_bh(&link->spin);
+
+	// a tasklet that ran before the flag was set may have armed the
+	// timer again, the second cancel catches it
+	hrtimer_cancel(&link->timer);
+	tasklet_kill(&link->tasklet);
+	hrtimer_cancel(&link->timer);
+
+	spin_lock_bh(&link->spin);
+	__skb_queue_purge(&link->queue);
+	link->busy_until = 0;
+	link->last_due = 0;
+	spin_unlock_bh(&link->spin);
+}
+
+
+static void wpantap_link_init(struct fakelb_phy *phy)
+{
+	struct wpantap_link *link = &phy->link;
+
+	spin_lock_init(&link->spin);
+	__skb_queue_head_init(&link->queue);
+	hrtimer_init(&link->timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	link->timer.function = wpantap_link_timer;
+	tasklet_init(&link->tasklet, wpantap_link_run, (unsigned long)phy);
+}
+
+
+// returns true if the phy is selected by name (an empty name selects all)
+static bool wpantap_phy_match(struct fakelb_phy *phy, const char *name)
+{
+	return name[0] == '\0' ||
+		strncmp(name, wpan_phy_name(phy->hw->phy), WPANTAP_PHY_NAME_LEN) == 0;
+}
+
+
+static int wpantap_link_set(struct wpantap_net *wn, struct wpantap_link_info *info)
+{
+	struct fakelb_phy *phy;
+	struct wpantap_link *link;
+	int found = 0;
+
+	info->phy[WPANTAP_PHY_NAME_LEN - 1] = '\0';
+	if(info->loss_ppm > 1000000){
+		return -EINVAL;
+	}
+
+	mutex_lock(&fakelb_phys_lock);
+	list_for_each_entry(phy, &wn->phys, list) {
+		if(!wpantap_phy_match(phy, info->phy)){
+			continue;
+		}
+
+		link = &phy->link;
+		spin_lock_bh(&link->spin);
+		link->loss_ppm = info->loss_ppm;
+		link->delay_us = info->delay_us;
+		link->jitter_us = info->jitter_us;
+		link->flags = info->flags;
+		link->enabled = info->loss_ppm != 0 || info->delay_us != 0 ||
+			info->jitter_us != 0 || (info->flags & WPANTAP_LINK_AIRTIME);
+		spin_unlock_bh(&link->spin);
+
+		found++;
+	}
+	mutex_unlock(&fakelb_phys_lock);
+
+	return found > 0 ? 0 : -ENODEV;
+}
+
+
+static int wpantap_link_get(struct wpantap_net *wn, struct wpantap_link_info *info)
+{
+	struct fakelb_phy *phy;
+	struct wpantap_link *link;
+	int err = -ENODEV;
+
+	info->phy[WPANTAP_PHY_NAME_LEN - 1] = '\0';
+
+	mutex_lock(&fakelb_phys_lock);
+	list_for_each_entry(phy, &wn->phys, list) {
+		if(!wpantap_phy_match(phy, info->phy)){
+			continue;
+		}
+
+		link = &phy->link;
+		strscpy(info->phy, wpan_phy_name(phy->hw->phy), WPANTAP_PHY_NAME_LEN);
+		spin_lock_bh(&link->spin);
+		info->loss_ppm = link->loss_ppm;
+		info->delay_us = link->delay_us;
+		info->jitter_us = link->jitter_us;
+		info->flags = link->flags;
+		info->queued = skb_queue_len(&link->queue);
+		info->delivered = link->delivered;
+		info->lost = link->lost;
+		info->drops = link->drops;
+		spin_unlock_bh(&link->spin);
+		spin_lock_bh(&phy->inject.queue.lock);
+		info->drops += phy->inject.drops;
+		spin_unlock_bh(&phy->inject.queue.lock);
+		info->bitrate = wpantap_phy_bitrate(phy->page, phy->channel);
+
+		err = 0;
+		break;
+	}
+	mutex_unlock(&fakelb_phys_lock);
+
+	return err;
+}
+
+
+static int wpantap_cpu_set(struct wpantap_net *wn, struct wpantap_cpu_info *info)
+{
+	struct fakelb_phy *phy;
+	int found = 0;
+
+	info->phy[WPANTAP_PHY_NAME_LEN - 1] = '\0';
+	if(info->cpu != WPANTAP_CPU_ANY &&
+	   (info->cpu < 0 || info->cpu >= nr_cpu_ids || !cpu_online(info->cpu))){
+		return -EINVAL;
+	}
+
+	mutex_lock(&fakelb_phys_lock);
+	list_for_each_entry(phy, &wn->phys, list) {
+		if(!wpantap_phy_match(phy, info->phy)){
+			continue;
+		}
+		// the next batch is steered, a scheduled tasklet runs where it is
+		WRITE_ONCE(phy->inject.cpu, info->cpu);
+		found++;
+	}
+	mutex_unlock(&fakelb_phys_lock);
+
+	return found > 0 ? 0 : -ENODEV;
+}
+
+
+static int wpantap_cpu_get(struct wpantap_net *wn, struct wpantap_cpu_info *info)
+{
+	struct fakelb_phy *phy;
+	int err = -ENODEV;
+
+	info->phy[WPANTAP_PHY_NAME_LEN - 1] = '\0';
+
+	mutex_lock(&fakelb_phys_lock);
+	list_for_each_entry(phy, &wn->phys, list) {
+		if(!wpantap_phy_match(phy, info->phy)){
+			continue;
+		}
+
+		strscpy(info->phy, wpan_phy_name(phy->hw->phy), WPANTAP_PHY_NAME_LEN);
+		info->cpu = READ_ONCE(phy->inject.cpu);
+		info->last_cpu = READ_ONCE(phy->inject.last_cpu);
+		spin_lock_bh(&phy->inject.queue.lock);
+		info->queued = skb_queue_len(&phy->inject.queue);
+		info->drops = phy->inject.drops;
+		spin_unlock_bh(&phy->inject.queue.lock);
+		info->reserved = 0;
+		err = 0;
+		break;
+	}
+	mutex_unlock(&fakelb_phys_lock);
+
+	return err;
+}
+
+/*
+ * UDP tunnel
+ *
+ * The frames sent by the stack on a phy with a tunnel are copied into one
+ * datagram per remote and sent from a kernel UDP socket; datagrams received
+ * on that socket are handed to the phy through the link emulation, like
+ * written frames. The socket and the remotes are replaced together, xmit
+ * and the encap_rcv callback only run under rcu_read_lock.
+ */
+
+#define WPANTAP_TUNNEL_HEADROOM (LL_MAX_HEADER + sizeof(struct iphdr) + sizeof(struct udphdr))
+
+
+static int wpantap_tunnel_rcv(struct sock *sk, struct sk_buff *skb)
+{
+	struct wpantap_tunnel *tun = rcu_dereference_sk_user_data(sk);
+	struct fakelb_phy *phy;
+	struct sk_buff *frame;
+	int len;
+
+	if(tun == NULL){
+		goto drop;
+	}
+	phy = tun->phy;
+
+	// the datagram holds a frame with FCS, the FCS is replaced by a zero one
+	len = skb->len - (int)sizeof(struct udphdr) - WPANTAP_FCS_LEN;
+	if(len <= 0 || len + WPANTAP_FCS_LEN > WPANTAP_FRAME_MAX){
+		goto err;
+	}
+
+	frame = wpantap_rx_skb_alloc(len);
+	if(frame == NULL){
+		goto err;
+	}
+	if(skb_copy_bits(skb, sizeof(struct udphdr), frame->data, len) != 0){
+		kfree_skb(frame);
+		goto err;
+	}
+	consume_skb(skb);
+
+	read_lock(&fakelb_ifup_phys_lock);
+	if(phy->suspended){
+		read_unlock(&fakelb_ifup_phys_lock);
+		kfree_skb(frame);
+		atomic64_inc(&tun->rx_errors);
+		return 0;
+	}
+	wpantap_link_rx(phy, frame);
+	read_unlock(&fakelb_ifup_phys_lock);
+
+	atomic64_inc(&tun->rx_frames);
+	return 0;
+
+err:
+	atomic64_inc(&tun->rx_errors);
+drop:
+	kfree_skb(skb);
+	return 0;
+}
+
+
+// sends a copy of skb (a frame with FCS) to every remote
+static void wpantap_tunnel_xmit(struct wpantap_tunnel *tun, struct sk_buff *skb)
+{
+	struct sockaddr_in *remote;
+	struct sk_buff *nskb;
+	struct flowi4 fl4;
+	struct rtable *rt;
+	int i;
+
+	for(i = 0; i < tun->nremotes; ++i){
+		remote = &tun->remotes[i];
+
+		memset(&fl4, 0, sizeof(fl4));
+		fl4.daddr = remote->sin_addr.s_addr;
+		fl4.flowi4_proto = IPPROTO_UDP;
+		fl4.fl4_sport = tun->port;
+		fl4.fl4_dport = remote->sin_port;
+		rt = ip_route_output_key(tun->net, &fl4);
+		if(IS_ERR(rt)){
+			atomic64_inc(&tun->tx_errors);
+			continue;
+		}
+
+		nskb = alloc_skb(WPANTAP_TUNNEL_HEADROOM + skb->len, GFP_ATOMIC);
+		if(nskb == NULL){
+			ip_rt_put(rt);
+			atomic64_inc(&tun->tx_errors);
+			continue;
+		}
+		skb_reserve(nskb, WPANTAP_TUNNEL_HEADROOM);
+		skb_copy_bits(skb, 0, skb_put(nskb, skb->len), skb->len);
+
+		udp_tunnel_xmit_skb(rt, tun->sock->sk, nskb, fl4.saddr, fl4.daddr, 0,
+				    ip4_dst_hoplimit(&rt->dst), 0, tun->port, remote->sin_port,
+				    false, false);
+		atomic64_inc(&tun->tx_frames);
+	}
+}
+
+
+static struct wpantap_tunnel *wpantap_tunnel_create(struct fakelb_phy *phy, struct wpantap_tunnel_info *info)
+{
+	struct udp_tunnel_sock_cfg tunnel_cfg;
+	struct udp_port_cfg udp_conf;
+	struct wpantap_tunnel *tun;
+	int err, i;
+
+	tun = kzalloc(sizeof(*tun), GFP_KERNEL);
+	if(tun == NULL){
+		return ERR_PTR(-ENOMEM);
+	}
+
+	tun->phy = phy;
+	tun->net = phy->wn->net;
+	tun->port = htons(info->local_port);
+	tun->flags = info->flags;
+	tun->nremotes = info->nremotes;
+	for(i = 0; i < info->nremotes; ++i){
+		tun->remotes[i].sin_family = AF_INET;
+		tun->remotes[i].sin_addr.s_addr = info->remotes[i].addr;
+		tun->remotes[i].sin_port = htons(info->remotes[i].port);
+	}
+
+	memset(&udp_conf, 0, sizeof(udp_conf));
+	udp_conf.family = AF_INET;
+	udp_conf.local_ip.s_addr = htonl(INADDR_ANY);
+	udp_conf.local_udp_port = tun->port;
+	err = udp_sock_create(tun->net, &udp_conf, &tun->sock);
+	if(err < 0){
+		kfree(tun);
+		return ERR_PTR(err);
+	}
+
+	memset(&tunnel_cfg, 0, sizeof(tunnel_cfg));
+	tunnel_cfg.sk_user_data = tun;
+	tunnel_cfg.encap_type = 1;
+	tunnel_cfg.encap_rcv = wpantap_tunnel_rcv;
+	setup_udp_tunnel_sock(tun->net, tun->sock, &tunnel_cfg);
+
+	return tun;
+}
+
+
+// the tunnel must already be unpublished from its phy
+static void wpantap_tunnel_release(struct wpantap_tunnel *tun)
+{
+	// wait for xmit to stop using the socket, then for encap_rcv
+	synchronize_rcu();
+	udp_tunnel_sock_release(tun->sock);
+	synchronize_rcu();
+
+	kfree(tun);
+}
+
+
+// called with fakelb_phys_lock held
+static void wpantap_tunnel_remove(struct fakelb_phy *phy)
+{
+	struct wpantap_tunnel *tun = rcu_dereference_protected(phy->tunnel,
+		lockdep_is_held(&fakelb_phys_lock));
+
+	if(tun != NULL){
+		RCU_INIT_POINTER(phy->tunnel, NULL);
+		wpantap_tunnel_release(tun);
+	}
+}
+
+
+static int wpantap_tunnel_set(struct wpantap_net *wn, struct wpantap_tunnel_info *info)
+{
+	struct fakelb_phy *phy;
+	struct wpantap_tunnel *tun;
+	int err = -ENODEV;
+
+	info->phy[WPANTAP_PHY_NAME_LEN - 1] = '\0';
+	if(info->nremotes > WPANTAP_TUNNEL_REMOTES_MAX){
+		return -EINVAL;
+	}
+
+	mutex_lock(&fakelb_phys_lock);
+	list_for_each_entry(phy, &wn->phys, list) {
+		if(!wpantap_phy_match(phy, info->phy)){
+			continue;
+		}
+
+		// the old socket goes first, the new one may take the same port
+		wpantap_tunnel_remove(phy);
+
+		err = 0;
+		if(info->local_port != 0){
+			tun = wpantap_tunnel_create(phy, info);
+			if(IS_ERR(tun)){
+				err = PTR_ERR(tun);
+				break;
+			}
+			rcu_assign_pointer(phy->tunnel, tun);
+		}
+		break;
+	}
+	mutex_unlock(&fakelb_phys_lock);
+
+	return err;
+}
+
+
+static int wpantap_tunnel_get(struct wpantap_net *wn, struct wpantap_tunnel_info *info)
+{
+	struct fakelb_phy *phy;
+	struct wpantap_tunnel *tun;
+	int err = -ENODEV;
+	int i;
+
+	info->phy[WPANTAP_PHY_NAME_LEN - 1] = '\0';
+
+	mutex_lock(&fakelb_phys_lock);
+	list_for_each_entry(phy, &wn->phys, list) {
+		if(!wpantap_phy_match(phy, info->phy)){
+			continue;
+		}
+
+		memset(info, 0, sizeof(*info));
+		strscpy(info->phy, wpan_phy_name(phy->hw->phy), WPANTAP_PHY_NAME_LEN);
+
+		tun = rcu_dereference_protected(phy->tunnel, lockdep_is_held(&fakelb_phys_lock));
+		if(tun != NULL){
+			info->local_port = ntohs(tun->port);
+			info->flags = tun->flags;
+			info->nremotes = tun->nremotes;
+			for(i = 0; i < tun->nremotes; ++i){
+				info->remotes[i].addr = tun->remotes[i].sin_addr.s_addr;
+				info->remotes[i].port = ntohs(tun->remotes[i].sin_port);
+			}
+			info->tx_frames = atomic64_read(&tun->tx_frames);
+			info->tx_errors = atomic64_read(&tun->tx_errors);
+			info->rx_frames = atomic64_read(&tun->rx_frames);
+			info->rx_errors = atomic64_read(&tun->rx_errors);
+		}
+
+		err = 0;
+		break;
+	}
+	mutex_unlock(&fakelb_phys_lock);
+
+	return err;
+}
+
+static int fakelb_hw_ed(struct ieee802154_hw *hw, u8 *level)
+{
+	WARN_ON(!level);
+	*level = 0xbe;
+
+	return 0;
+}
+
+static int fakelb_hw_channel(struct ieee802154_hw *hw, u8 page, u8 channel)
+{
+	struct fakelb_phy *phy = hw->priv;
+
+	write_lock_bh(&fakelb_ifup_phys_lock);
+	phy->page = page;
+	phy->channel = channel;
+	write_unlock_bh(&fakelb_ifup_phys_lock);
+	return 0;
+}
+
+static int fakelb_hw_xmit(struct ieee802154_hw *hw, struct sk_buff *skb)
+{
+	struct fakelb_phy *current_phy = hw->priv;
+	struct wpantap_net *wn = current_phy->wn;
+	struct wpantap_tunnel *tun;
+	int head_len;
+	// capture time of the frame, stored in front of it in the ring buffer
+	u64 tstamp = wpantap_now(wn);
+
+	read_lock_bh(&fakelb_ifup_phys_lock);
+	WARN_ON(current_phy->suspended);
+	
+	
+	printk_dbg(KERN_DEBUG "wpantap: sending packet with WPAN device...\n");
+	printk_dbg(KERN_DEBUG "wpantap: skb len:%d data_len %d\n", skb->len, skb->data_len);
+	//printk(KERN_DEBUG "first bytes: %02x %02x %02x %02x\n", (char*)skb->data[0], (char*)skb->data[1], (char*)skb->data[2], (char*)skb->data[3]);
+
+	head_len = skb->len - skb->data_len;
+
+	rcu_read_lock();
+	tun = rcu_dereference(current_phy->tunnel);
+	if(tun != NULL){
+		wpantap_tunnel_xmit(tun, skb);
+	}
+	// read() takes frames into buffers of at most WPANTAP_FRAME_MAX bytes
+	if((tun == NULL || (tun->flags & WPANTAP_TUNNEL_RING)) && skb->len <= WPANTAP_FRAME_MAX &&
+	   !wpantap_fq_enqueue(wn, skb, tstamp)){
+		spin_lock_bh(&wn->ringbuf_spin);
+		ringbuf_insert_data2(&wn->rbuf, sizeof(tstamp), &tstamp, skb->len, skb->data);
+		spin_unlock_bh(&wn->ringbuf_spin);
+	}
+	rcu_read_unlock();
+
+	wpantap_mirror_feed(wn, skb, tstamp);
+	
+	read_unlock_bh(&fakelb_ifup_phys_lock);
+
+	// the key lets poll waiters (epoll, io_uring) that only want POLLOUT sleep on
+	wake_up_interruptible_poll(&wn->wait, POLLIN | POLLRDNORM);
+
+	ieee802154_xmit_complete(hw, skb, false);
+	return 0;
+}
+
+static int fakelb_hw_start(struct ieee802154_hw *hw)
+{
+	struct fakelb_phy *phy = hw->priv;
+
+	spin_lock_bh(&phy->link.spin);
+	phy->link.stopping = false;
+	spin_unlock_bh(&phy->link.spin);
+
+	write_lock_bh(&fakelb_ifup_phys_lock);
+	phy->suspended = false;
+	list_add(&phy->list_ifup, &phy->wn->ifup_phys);
+	write_unlock_bh(&fakelb_ifup_phys_lock);
+
+	return 0;
+}
+
+static void fakelb_hw_stop(struct ieee802154_hw *hw)
+{
+	struct fakelb_phy *phy = hw->priv;
+
+	write_lock_bh(&fakelb_ifup_phys_lock);
+	phy->suspended = true;
+	list_del(&phy->list_ifup);
+	write_unlock_bh(&fakelb_ifup_phys_lock);
+
+	wpantap_link_flush(&phy->link);
+	wpantap_inject_flush(&phy->inject);
+}
+
+static int
+fakelb_set_promiscuous_mode(struct ieee802154_hw *hw, const bool on)
+{
+	return 0;
+}
+
+static const struct ieee802154_ops fakelb_ops = {
+	.owner = THIS_MODULE,
+	.xmit_async = fakelb_hw_xmit,
+	.ed = fakelb_hw_ed,
+	.set_channel = fakelb_hw_channel,
+	.start = fakelb_hw_start,
+	.stop = fakelb_hw_stop,
+	.set_promiscuous_mode = fakelb_set_promiscuous_mode,
+};
+
+/* Number of dummy devices to be set up by this module in each
+   network namespace.
+*/
+module_param(numlbs, int, 0444);
+MODULE_PARM_DESC(numlbs, " number of pseudo devices per network namespace");
+
+// called with fakelb_phys_lock held
+static int fakelb_add_one(struct device *dev, struct wpantap_net *wn)
+{
+	struct ieee802154_hw *hw;
+	struct fakelb_phy *phy;
+	int err;
+
+	hw = ieee802154_alloc_hw(sizeof(*phy), &fakelb_ops);
+	if (!hw)
+		return -ENOMEM;
+
+	phy = hw->priv;
+	phy->hw = hw;
+	phy->wn = wn;
+	// down until fakelb_hw_start
+	phy->suspended = true;
+	wpantap_inject_init(phy);
+	wpantap_link_init(phy);
 
 	/* 868 MHz BPSK	802.15.4-2003 */
 	hw->phy->supported.channels[0] |= 1;
@@ -423,223 +1642,1171 @@ static int fakelb_add_one(struct device *dev)
 	/* 950 MHz GFSK 802.15.4d-2009 */
 	hw->phy->supported.channels[6] |= 0x3ffc00;
 
-	ieee802154_random_extended_addr(&hw->phy->perm_extended_addr);
-	/* fake phy channel 13 as default */
-	hw->phy->current_channel = 13;
-	phy->channel = hw->phy->current_channel;
+	ieee802154_random_extended_addr(&hw->phy->perm_extended_addr);
+	/* fake phy channel 13 as default */
+	hw->phy->current_channel = 13;
+	phy->channel = hw->phy->current_channel;
+
+	hw->flags = IEEE802154_HW_PROMISCUOUS;
+	hw->parent = dev;
+	// the phy and its wpan interface are created in the namespace
+	wpan_phy_net_set(hw->phy, wn->net);
+
+	err = ieee802154_register_hw(hw);
+	if (err)
+		goto err_reg;
+
+	list_add_tail(&phy->list, &wn->phys);
+
+	return 0;
+
+err_reg:
+	ieee802154_free_hw(phy->hw);
+	return err;
+}
+
+static void fakelb_del(struct fakelb_phy *phy)
+{
+	list_del(&phy->list);
+	wpantap_tunnel_remove(phy);
+
+	ieee802154_unregister_hw(phy->hw);
+	wpantap_link_flush(&phy->link);
+	wpantap_inject_flush(&phy->inject);
+	ieee802154_free_hw(phy->hw);
+}
+
+// called with fakelb_phys_lock held
+static void fakelb_del_all(struct wpantap_net *wn)
+{
+	struct fakelb_phy *phy, *tmp;
+
+	list_for_each_entry_safe(phy, tmp, &wn->phys, list)
+		fakelb_del(phy);
+}
+
+// adds the numlbs phys of an instance, called with fakelb_phys_lock held
+static int fakelb_add_all(struct device *dev, struct wpantap_net *wn)
+{
+	int err, i;
+
+	if (wn->phys_added)
+		return 0;
+
+	for (i = 0; i < numlbs; i++) {
+		err = fakelb_add_one(dev, wn);
+		if (err < 0) {
+			fakelb_del_all(wn);
+			return err;
+		}
+	}
+
+	wn->phys_added = true;
+	dev_info(dev, "wpantap: added %i fake ieee802154 tap device(s)\n", numlbs);
+	return 0;
+}
+
+static int fakelb_probe(struct platform_device *pdev)
+{
+	int err;
+
+	// the initial namespace gets its phys right away
+	mutex_lock(&fakelb_phys_lock);
+	err = fakelb_add_all(&pdev->dev, wpantap_pernet(&init_net));
+	mutex_unlock(&fakelb_phys_lock);
+	return err;
+}
+
+static int fakelb_remove(struct platform_device *pdev)
+{
+	// the phys go away with their instance, see wpantap_net_exit
+	return 0;
+}
+
+static struct platform_device *ieee802154fake_dev;
+
+static struct platform_driver ieee802154fake_driver = {
+	.probe = fakelb_probe,
+	.remove = fakelb_remove,
+	.driver = {
+			.name = "ieee802154tap",
+	},
+};
+
+static int fakelb_init_module(void)
+{
+	ieee802154fake_dev = platform_device_register_simple(
+			     "ieee802154tap", -1, NULL, 0);
+
+	//pr_warn("fakelb driver is marked as deprecated, please use mac802154_hwsim!\n");
+
+	return platform_driver_register(&ieee802154fake_driver);
+}
+
+static void fake_remove_module(void)
+{
+	platform_driver_unregister(&ieee802154fake_driver);
+	platform_device_unregister(ieee802154fake_dev);
+}
+
+
+// a frame taken off the ring buffer or a mirror queue, ready to be copied out
+struct wpantap_frame {
+	void *data;
+	int len;
+	u64 tstamp;
+
+	// the frame memory is owned by either buf (from cache) or skb
+	void *buf;
+	struct kmem_cache *cache;
+	struct sk_buff *skb;
+};
+
+static void wpantap_frame_release(struct wpantap_frame *frame)
+{
+	if(frame->skb != NULL){
+		consume_skb(frame->skb);
+	}
+	wpantap_frame_buf_free(frame->cache, frame->buf);
+}
+
+
+// takes the oldest frame off the ring buffer without blocking
+// returns 0 on success, -EAGAIN if the buffer is empty
+// and -EMSGSIZE if the frame is longer than max_len (it is left in place)
+// gfp is for the frame buffer, GFP_NOWAIT keeps the fetch from sleeping
+static int wpantap_ring_fetch(struct wpantap_net *wn, struct wpantap_frame *frame, int max_len, gfp_t gfp)
+{
+	struct kmem_cache *cache;
+	int size, room = WPANTAP_FRAME_BUF_SMALL;
+	void *data;
+
+	// the buffer is allocated before taking the lock so that the
+	// allocation may sleep, a SUN frame that does not fit takes a
+	// second round with a large buffer
+	while(1){
+		data = wpantap_frame_buf_alloc(room, gfp, &cache);
+		if(data == NULL){
+			// a non-blocking caller retries from a context that may sleep
+			return gfpflags_allow_blocking(gfp) ? -ENOMEM : -EAGAIN;
+		}
+
+		spin_lock_bh(&wn->ringbuf_spin);
+
+		if(ringbuf_is_empty(&wn->rbuf) == 1){
+			spin_unlock_bh(&wn->ringbuf_spin);
+			wpantap_frame_buf_free(cache, data);
+			return -EAGAIN;
+		}
+
+		// each block holds the capture time followed by the frame
+		size = ringbuf_get_first_data_size(&wn->rbuf);
+		if(size - (int)sizeof(u64) > max_len){
+			spin_unlock_bh(&wn->ringbuf_spin);
+			wpantap_frame_buf_free(cache, data);
+			return -EMSGSIZE;
+		}
+		if(size <= room){
+			break;
+		}
+
+		spin_unlock_bh(&wn->ringbuf_spin);
+		wpantap_frame_buf_free(cache, data);
+		room = size;
+	}
+
+	ringbuf_copy_first_data(&wn->rbuf, data);
+	ringbuf_pop_data(&wn->rbuf);
+
+	spin_unlock_bh(&wn->ringbuf_spin);
+
+	memcpy(&frame->tstamp, data, sizeof(u64));
+	frame->data = data + sizeof(u64);
+	frame->len = size - sizeof(u64);
+	frame->buf = data;
+	frame->cache = cache;
+	frame->skb = NULL;
+	return 0;
+}
+
+
+// same as wpantap_ring_fetch, for the fair queue: the next frame in deficit
+// round robin order
+static int wpantap_fq_fetch(struct wpantap_net *wn, struct wpantap_frame *frame, int max_len)
+{
+	struct wpantap_fq *fq = &wn->fq;
+	struct wpantap_fq_flow *flow;
+	struct sk_buff *skb;
+
+	spin_lock_bh(&fq->spin);
+	// every round adds credit, a flow sends within a few rounds
+	while(!list_empty(&fq->active)){
+		flow = list_first_entry(&fq->active, struct wpantap_fq_flow, list);
+		skb = skb_peek(&flow->queue);
+
+		// out of credit, the flow gets its quantum for the next round
+		if(flow->deficit < (int)skb->len){
+			flow->deficit += fq->quantum;
+			list_move_tail(&flow->list, &fq->active);
+			continue;
+		}
+		if(skb->len > max_len){
+			spin_unlock_bh(&fq->spin);
+			return -EMSGSIZE;
+		}
+
+		__skb_unlink(skb, &flow->queue);
+		flow->deficit -= skb->len;
+		fq->queued--;
+		if(skb_queue_empty(&flow->queue)){
+			list_move_tail(&flow->list, &fq->idle);
+		}
+		spin_unlock_bh(&fq->spin);
+
+		frame->data = skb->data;
+		frame->len = skb->len;
+		frame->tstamp = ktime_to_ns(skb->tstamp);
+		frame->buf = NULL;
+		frame->skb = skb;
+		return 0;
+	}
+	spin_unlock_bh(&fq->spin);
+
+	return -EAGAIN;
+}
+
+
+// same as wpantap_ring_fetch, for the private queue of a mirror
+static int wpantap_mirror_fetch(struct wpantap_mirror *mirror, struct wpantap_frame *frame, int max_len)
+{
+	struct sk_buff *skb;
+	unsigned long flags;
+
+	spin_lock_irqsave(&mirror->queue.lock, flags);
+	skb = skb_peek(&mirror->queue);
+	if(skb != NULL && skb->len <= max_len){
+		__skb_unlink(skb, &mirror->queue);
+	}
+	spin_unlock_irqrestore(&mirror->queue.lock, flags);
+
+	if(skb == NULL){
+		return -EAGAIN;
+	}else if(skb->len > max_len){
+		return -EMSGSIZE;
+	}
+
+	frame->data = skb->data;
+	frame->len = skb->len;
+	frame->tstamp = ktime_to_ns(skb->tstamp);
+	frame->buf = NULL;
+	frame->skb = skb;
+	return 0;
+}
+
+
+static int wpantap_fetch(struct wpantap_file *tfile, struct wpantap_frame *frame, int max_len, gfp_t gfp)
+{
+	int ret;
+
+	if(tfile->mirror != NULL){
+		return wpantap_mirror_fetch(tfile->mirror, frame, max_len);
+	}
+	// frames queued in the ring buffer before fair queueing was turned
+	// on are read after the fair queue
+	if(READ_ONCE(tfile->wn->fq.enabled)){
+		ret = wpantap_fq_fetch(tfile->wn, frame, max_len);
+		if(ret != -EAGAIN){
+			return ret;
+		}
+	}
+	return wpantap_ring_fetch(tfile->wn, frame, max_len, gfp);
+}
+
+
+static bool wpantap_readable(struct wpantap_file *tfile)
+{
+	int rbempty;
+
+	if(tfile->mirror != NULL){
+		return !skb_queue_empty(&tfile->mirror->queue);
+	}
+
+	if(READ_ONCE(tfile->wn->fq.queued) != 0){
+		return true;
+	}
+
+	spin_lock_bh(&tfile->wn->ringbuf_spin);
+	rbempty = ringbuf_is_empty(&tfile->wn->rbuf);
+	spin_unlock_bh(&tfile->wn->ringbuf_spin);
+
+	return rbempty != 1;
+}
+
+
+// copies a frame as is, truncated to the size of the user buffer
+static ssize_t wpantap_put_raw(struct wpantap_frame *frame, struct iov_iter *to)
+{
+	size_t size = min_t(size_t, frame->len, iov_iter_count(to));
+
+	if(copy_to_iter(frame->data, size, to) != size){
+		return -EFAULT;
+	}
+	return size;
+}
+
+
+/*
+ * pcapng read format
+ *
+ * The stream starts with a section header and a single interface description
+ * (IEEE 802.15.4 with FCS, nanosecond timestamps), followed by one enhanced
+ * packet block per frame. All fields are in host byte order, which the
+ * section header announces through its byte-order magic.
+ */
+#define PCAPNG_BT_SHB 0x0A0D0D0A
+#define PCAPNG_BT_IDB 0x00000001
+#define PCAPNG_BT_EPB 0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+#define PCAPNG_OPT_IF_TSRESOL 9
+// LINKTYPE_IEEE802_15_4_WITHFCS, frames handed to the driver carry their FCS
+#define PCAPNG_LINKTYPE_IEEE802_15_4 195
+#define PCAPNG_SNAPLEN 65535
+
+struct pcapng_shb {
+	u32 block_type;
+	u32 block_len;
+	u32 magic;
+	u16 major;
+	u16 minor;
+	u64 section_len;
+	u32 block_len2;
+} __packed;
+
+struct pcapng_idb {
+	u32 block_type;
+	u32 block_len;
+	u16 linktype;
+	u16 reserved;
+	u32 snaplen;
+	// if_tsresol option: 10^-9 seconds
+	u16 tsresol_code;
+	u16 tsresol_len;
+	u8 tsresol;
+	u8 tsresol_pad[3];
+	// opt_endofopt
+	u16 end_code;
+	u16 end_len;
+	u32 block_len2;
+} __packed;
+
+struct pcapng_epb {
+	u32 block_type;
+	u32 block_len;
+	u32 interface_id;
+	u32 ts_high;
+	u32 ts_low;
+	u32 cap_len;
+	u32 orig_len;
+} __packed;
+
+// bytes of an enhanced packet block that are not frame data
+#define PCAPNG_EPB_OVERHEAD (sizeof(struct pcapng_epb) + sizeof(u32))
+
+
+static ssize_t wpantap_pcapng_put_header(struct wpantap_file *tfile, struct iov_iter *to)
+{
+	struct {
+		struct pcapng_shb shb;
+		struct pcapng_idb idb;
+	} __packed hdr;
+
+	if(iov_iter_count(to) < sizeof(hdr)){
+		return -EINVAL;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+
+	hdr.shb.block_type = PCAPNG_BT_SHB;
+	hdr.shb.block_len = sizeof(hdr.shb);
+	hdr.shb.magic = PCAPNG_BYTE_ORDER_MAGIC;
+	hdr.shb.major = 1;
+	hdr.shb.minor = 0;
+	// the length of a live stream is unknown
+	hdr.shb.section_len = (u64)-1;
+	hdr.shb.block_len2 = sizeof(hdr.shb);
+
+	hdr.idb.block_type = PCAPNG_BT_IDB;
+	hdr.idb.block_len = sizeof(hdr.idb);
+	hdr.idb.linktype = PCAPNG_LINKTYPE_IEEE802_15_4;
+	hdr.idb.snaplen = PCAPNG_SNAPLEN;
+	hdr.idb.tsresol_code = PCAPNG_OPT_IF_TSRESOL;
+	hdr.idb.tsresol_len = 1;
+	hdr.idb.tsresol = 9;
+	hdr.idb.block_len2 = sizeof(hdr.idb);
+
+	if(copy_to_iter(&hdr, sizeof(hdr), to) != sizeof(hdr)){
+		return -EFAULT;
+	}
+
+	tfile->pcapng_started = true;
+	return sizeof(hdr);
+}
+
+
+// writes one enhanced packet block, returns its size
+static ssize_t wpantap_pcapng_put_frame(struct wpantap_frame *frame, struct iov_iter *to)
+{
+	static const u8 pad[4];
+	struct pcapng_epb epb;
+	size_t room = iov_iter_count(to);
+	u32 cap_len, data_len, block_len;
+
+	if(room < PCAPNG_EPB_OVERHEAD){
+		return -EINVAL;
+	}
+
+	// a short user buffer truncates the captured part, like a snaplen
+	cap_len = min_t(size_t, frame->len, (room - PCAPNG_EPB_OVERHEAD) & ~3);
+	data_len = ALIGN(cap_len, 4);
+	block_len = PCAPNG_EPB_OVERHEAD + data_len;
+
+	epb.block_type = PCAPNG_BT_EPB;
+	epb.block_len = block_len;
+	epb.interface_id = 0;
+	epb.ts_high = (u32)(frame->tstamp >> 32);
+	epb.ts_low = (u32)frame->tstamp;
+	epb.cap_len = cap_len;
+	epb.orig_len = frame->len;
+
+	if(copy_to_iter(&epb, sizeof(epb), to) != sizeof(epb) ||
+	   copy_to_iter(frame->data, cap_len, to) != cap_len ||
+	   copy_to_iter(pad, data_len - cap_len, to) != data_len - cap_len ||
+	   copy_to_iter(&block_len, sizeof(block_len), to) != sizeof(block_len)){
+		return -EFAULT;
+	}
+
+	return block_len;
+}
+
+
+// copies a frame preceded by its metadata, returns the size of the record
+static ssize_t wpantap_meta_put_frame(struct wpantap_frame *frame, struct iov_iter *to)
+{
+	static const u8 pad[WPANTAP_META_ALIGN];
+	struct wpantap_meta meta;
+	size_t rec_size = WPANTAP_META_REC_SIZE(frame->len);
+	size_t pad_len = rec_size - sizeof(meta) - frame->len;
+
+	if(iov_iter_count(to) < rec_size){
+		return -EMSGSIZE;
+	}
+
+	meta.tstamp_ns = frame->tstamp;
+	meta.len = frame->len;
+	meta.flags = 0;
+
+	if(copy_to_iter(&meta, sizeof(meta), to) != sizeof(meta) ||
+	   copy_to_iter(frame->data, frame->len, to) != frame->len ||
+	   copy_to_iter(pad, pad_len, to) != pad_len){
+		return -EFAULT;
+	}
+
+	return rec_size;
+}
+
+
+// the longest frame whose whole record fits in room bytes (batched formats)
+static int wpantap_frame_room(struct wpantap_file *tfile, size_t room)
+{
+	room = min_t(size_t, room, INT_MAX);
+
+	switch(tfile->format){
+	case WPANTAP_FMT_PCAPNG:
+		if(room < PCAPNG_EPB_OVERHEAD){
+			return 0;
+		}
+		return (room - PCAPNG_EPB_OVERHEAD) & ~3;
+	case WPANTAP_FMT_META:
+		if(room < sizeof(struct wpantap_meta)){
+			return 0;
+		}
+		return (room - sizeof(struct wpantap_meta)) & ~(WPANTAP_META_ALIGN - 1);
+	default:
+		return room;
+	}
+}
+
+
+static ssize_t wpantap_put_frame(struct wpantap_file *tfile, struct wpantap_frame *frame, struct iov_iter *to)
+{
+	switch(tfile->format){
+	case WPANTAP_FMT_PCAPNG:
+		return wpantap_pcapng_put_frame(frame, to);
+	case WPANTAP_FMT_META:
+		return wpantap_meta_put_frame(frame, to);
+	default:
+		return wpantap_put_raw(frame, to);
+	}
+}
+
+
+static ssize_t wpantap_chr_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct file *file = iocb->ki_filp;
+	struct wpantap_file *tfile;
+	struct wpantap_frame frame;
+	ssize_t total = 0;
+	ssize_t ret;
+	int max_len;
+	gfp_t gfp;
+
+	if(!file){
+		return -EBADFD;
+	}
+	
+	printk_dbg(KERN_DEBUG "wpantap: entering read opration\n");
+
+	// io_uring completes an IOCB_NOWAIT read inline, it must not sleep
+	gfp = (iocb->ki_flags & IOCB_NOWAIT) ? GFP_NOWAIT : GFP_KERNEL;
+
+	tfile = file->private_data;
+
+	// a pcapng stream starts with its section and interface headers
+	if(tfile->format == WPANTAP_FMT_PCAPNG && !tfile->pcapng_started){
+		return wpantap_pcapng_put_header(tfile, to);
+	}
+
+	max_len = wpantap_frame_room(tfile, iov_iter_count(to));
+	if(tfile->format != WPANTAP_FMT_RAW && max_len <= 0){
+		return -EINVAL;
+	}
+	// raw and pcapng reads truncate a frame that does not fit
+	if(tfile->format != WPANTAP_FMT_META){
+		max_len = INT_MAX;
+	}
+
+	while(1){
+		ret = wpantap_fetch(tfile, &frame, max_len, gfp);
+		if(ret != -EAGAIN){
+			break;
+		}
+
+		// io_uring submits with IOCB_NOWAIT first and arms a poll on -EAGAIN
+		if((file->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT)){
+			return -EAGAIN;
+		}
+
+		// sleep until fakelb_hw_xmit queues a frame
+		ret = wait_event_interruptible(tfile->wn->wait, wpantap_readable(tfile));
+		if(ret != 0){
+			return ret;
+		}
+	}
+
+	if(ret != 0){
+		return ret;
+	}
+
+	if(tfile->format == WPANTAP_FMT_RAW){
+		ret = wpantap_put_raw(&frame, to);
+		wpantap_frame_release(&frame);
+		return ret;
+	}
+
+	// fill the user buffer with as many whole records as are ready
+	while(1){
+		ret = wpantap_put_frame(tfile, &frame, to);
+		wpantap_frame_release(&frame);
+		if(ret < 0){
+			break;
+		}
+		total += ret;
+
+		max_len = wpantap_frame_room(tfile, iov_iter_count(to));
+		if(max_len <= 0){
+			break;
+		}
+		// frames that do not fit wait for the next read
+		ret = wpantap_fetch(tfile, &frame, max_len, gfp);
+		if(ret != 0){
+			break;
+		}
+	}
+
+	return total > 0 ? total : ret;
+}
+
+
+// hands a frame (with FCS) to a phy of an instance, consumes newskb
+// an empty name selects the first phy that is up
+static void rx_irqsafe_skb(struct wpantap_net *wn, const char *name, struct sk_buff *newskb) {
+	struct fakelb_phy *phy;
+	bool delivered = false;
+
+	read_lock_bh(&fakelb_ifup_phys_lock);
+
+	list_for_each_entry(phy, &wn->ifup_phys, list_ifup) {
+		if(!wpantap_phy_match(phy, name)){
+			continue;
+		}
+		wpantap_link_rx(phy, newskb);
+		delivered = true;
+		break;
+	}
+
+	read_unlock_bh(&fakelb_ifup_phys_lock);
+
+	// the interface is down
+	if(!delivered){
+		kfree_skb(newskb);
+	}
+}
+
+
+// selects the phy that the frames written to tfile go to
+static int wpantap_file_set_phy(struct wpantap_file *tfile, struct wpantap_phy_sel *sel)
+{
+	struct fakelb_phy *phy;
+	int err = -ENODEV;
+
+	sel->phy[WPANTAP_PHY_NAME_LEN - 1] = '\0';
+
+	mutex_lock(&fakelb_phys_lock);
+	list_for_each_entry(phy, &tfile->wn->phys, list) {
+		if(wpantap_phy_match(phy, sel->phy)){
+			err = 0;
+			break;
+		}
+	}
+	mutex_unlock(&fakelb_phys_lock);
+
+	if(err == 0){
+		memcpy(tfile->phy, sel->phy, WPANTAP_PHY_NAME_LEN);
+	}
+	return err;
+}
+
+
+static void wpantap_vtime_insert(struct wpantap_vtime *vt, struct sk_buff *skb)
+{
+	struct rb_node **p = &vt->queue.rb_root.rb_node;
+	struct rb_node *parent = NULL;
+	struct sk_buff *q;
+	bool leftmost = true;
+
+	while(*p != NULL){
+		parent = *p;
+		q = rb_entry(parent, struct sk_buff, rbnode);
+		// frames with the same delivery time keep the write order
+		if(ktime_compare(skb->tstamp, q->tstamp) >= 0){
+			p = &parent->rb_right;
+			leftmost = false;
+		}else{
+			p = &parent->rb_left;
+		}
+	}
+
+	rb_link_node(&skb->rbnode, parent, p);
+	rb_insert_color_cached(&skb->rbnode, &vt->queue, leftmost);
+	vt->queued++;
+}
+
+
+// delivers every queued frame due by limit, in time order
+// the caller holds vt->spin, returns the number of frames delivered
+static int wpantap_vtime_release(struct wpantap_vtime *vt, u64 limit)
+{
+	struct wpantap_net *wn = container_of(vt, struct wpantap_net, vtime);
+	char phy[WPANTAP_PHY_NAME_LEN];
+	struct rb_node *node;
+	struct sk_buff *skb;
+	int count = 0;
+
+	while((node = rb_first_cached(&vt->queue)) != NULL){
+		skb = rb_entry(node, struct sk_buff, rbnode);
+		if(ktime_to_ns(skb->tstamp) > limit){
+			break;
+		}
+
+		rb_erase_cached(node, &vt->queue);
+		vt->queued--;
+		// rbnode shares its memory with the list pointers and dev
+		skb->dev = NULL;
+
+		memcpy(phy, WPANTAP_VTIME_CB(skb)->phy, WPANTAP_PHY_NAME_LEN);
+		rx_irqsafe_skb(wn, phy, skb);
+		count++;
+	}
+
+	return count;
+}
+
+
+// delivers a written frame to the phy called name, holding it back until
+// time in virtual time mode
+static int wpantap_vtime_inject(struct wpantap_vtime *vt, const char *name, struct sk_buff *skb, u64 time)
+{
+	spin_lock_bh(&vt->spin);
+
+	if(vt->enabled && time > vt->now){
+		if(vt->queued >= WPANTAP_VTIME_QUEUE_MAX){
+			spin_unlock_bh(&vt->spin);
+			kfree_skb(skb);
+			return -ENOBUFS;
+		}
+
+		skb->tstamp = ns_to_ktime(time);
+		memcpy(WPANTAP_VTIME_CB(skb)->phy, name, WPANTAP_PHY_NAME_LEN);
+		wpantap_vtime_insert(vt, skb);
+		spin_unlock_bh(&vt->spin);
+		return 0;
+	}
+
+	spin_unlock_bh(&vt->spin);
+
+	rx_irqsafe_skb(container_of(vt, struct wpantap_net, vtime), name, skb);
+	return 0;
+}
+
+
+// moves the virtual clock forward, returns the number of frames released
+static int wpantap_vtime_advance(struct wpantap_vtime *vt, u64 target)
+{
+	int count;
+
+	spin_lock_bh(&vt->spin);
+
+	if(!vt->enabled || target < vt->now){
+		spin_unlock_bh(&vt->spin);
+		return -EINVAL;
+	}
+
+	// delivering under the lock keeps the order deterministic
+	count = wpantap_vtime_release(vt, target);
+	WRITE_ONCE(vt->now, target);
+
+	spin_unlock_bh(&vt->spin);
+
+	return count;
+}
+
+
+static void wpantap_vtime_set(struct wpantap_vtime *vt, struct wpantap_vtime_info *info)
+{
+	spin_lock_bh(&vt->spin);
+
+	WRITE_ONCE(vt->now, info->now_ns);
+	WRITE_ONCE(vt->enabled, info->enabled != 0);
+
+	// leaving virtual time mode releases everything still held back
+	if(!vt->enabled){
+		wpantap_vtime_release(vt, U64_MAX);
+	}
+
+	spin_unlock_bh(&vt->spin);
+}
+
+
+static void wpantap_vtime_get(struct wpantap_vtime *vt, struct wpantap_vtime_info *info)
+{
+	spin_lock_bh(&vt->spin);
+	info->now_ns = vt->now;
+	info->enabled = vt->enabled;
+	info->queued = vt->queued;
+	spin_unlock_bh(&vt->spin);
+}
+
+
+static void wpantap_vtime_init(struct wpantap_vtime *vt)
+{
+	spin_lock_init(&vt->spin);
+	vt->queue = RB_ROOT_CACHED;
+}
+
+
+static void wpantap_vtime_deinit(struct wpantap_vtime *vt)
+{
+	struct rb_node *node;
+	struct sk_buff *skb;
+
+	spin_lock_bh(&vt->spin);
+	vt->enabled = false;
+	while((node = rb_first_cached(&vt->queue)) != NULL){
+		skb = rb_entry(node, struct sk_buff, rbnode);
+		rb_erase_cached(node, &vt->queue);
+		skb->dev = NULL;
+		kfree_skb(skb);
+	}
+	vt->queued = 0;
+	spin_unlock_bh(&vt->spin);
+}
+
+
+// writes one or more metadata records to the phy called name, returns the
+// bytes consumed
+static ssize_t wpantap_meta_write(struct wpantap_net *wn, const char *name, struct iov_iter *from)
+{
+	struct wpantap_meta meta;
+	struct sk_buff *skb;
+	ssize_t total = 0;
+	ssize_t rec_size;
+	int err = -EINVAL;
+
+	while(iov_iter_count(from) >= sizeof(meta)){
+		if(copy_from_iter(&meta, sizeof(meta), from) != sizeof(meta)){
+			err = -EFAULT;
+			break;
+		}
+
+		rec_size = wpantap_meta_rec_check(&meta, iov_iter_count(from));
+		if(rec_size < 0){
+			err = rec_size;
+			break;
+		}
+
+		skb = wpantap_rx_skb_from_iter(from, meta.len);
+		if(IS_ERR(skb)){
+			err = PTR_ERR(skb);
+			break;
+		}
+		iov_iter_advance(from, rec_size - sizeof(meta) - meta.len);
+
+		err = wpantap_vtime_inject(&wn->vtime, name, skb, meta.tstamp_ns);
+		if(err != 0){
+			break;
+		}
+		total += rec_size;
+	}
+
+	return total > 0 ? total : err;
+}
+
+
+/*
+ * Kernel-side traffic replay
+ *
+ * User space loads a trace (see struct wpantap_trace_rec) with one ioctl
+ * and starts it. An hrtimer fires when the next frame is due and kicks a
+ * tasklet, which injects every frame that is due by then through the same
+ * path as write(), at most WPANTAP_REPLAY_BUDGET per run.
+ */
+#define WPANTAP_REPLAY_BUDGET 64
+
+
+// returns 0 if the trace is well-formed
+static int wpantap_trace_validate(void *trace, u32 len)
+{
+	struct wpantap_trace_rec *rec;
+	u64 last_offset = 0;
+	u32 pos = 0;
+
+	while(pos < len){
+		if(len - pos < sizeof(*rec)){
+			return -EINVAL;
+		}
+
+		rec = trace + pos;
+		if(rec->len == 0 || rec->len + WPANTAP_FCS_LEN > WPANTAP_FRAME_MAX){
+			printk(KERN_ERR "wpantap: replay record at %u has invalid length %u\n", pos, rec->len);
+			return -EINVAL;
+		}
+		if(WPANTAP_TRACE_REC_SIZE(rec->len) > len - pos){
+			printk(KERN_ERR "wpantap: replay record at %u is truncated\n", pos);
+			return -EINVAL;
+		}
+		if(rec->offset_ns < last_offset){
+			printk(KERN_ERR "wpantap: replay record at %u goes back in time\n", pos);
+			return -EINVAL;
+		}
+
+		last_offset = rec->offset_ns;
+		pos += WPANTAP_TRACE_REC_SIZE(rec->len);
+	}
+
+	return 0;
+}
+
+
+static ktime_t wpantap_replay_due(struct wpantap_replay *rp, struct wpantap_trace_rec *rec)
+{
+	if(rp->cfg.mode == WPANTAP_REPLAY_MAXRATE){
+		return ktime_add_ns(rp->start, rp->index * rp->interval_ns);
+	}
+	return ktime_add_ns(rp->start, mul_u64_u32_div(rec->offset_ns, 1000, rp->cfg.speed));
+}
+
+
+static void wpantap_replay_inject(struct wpantap_replay *rp, struct wpantap_trace_rec *rec)
+{
+	struct sk_buff *skb = wpantap_rx_skb_copy(rec + 1, rec->len);
+
+	if(skb == NULL){
+		rp->stats.drops++;
+		return;
+	}
+
+	rx_irqsafe_skb(container_of(rp, struct wpantap_net, replay), rp->phy, skb);
+
+	rp->stats.frames++;
+	rp->stats.bytes += rec->len;
+}
+
+
+static void wpantap_replay_run(unsigned long data)
+{
+	struct wpantap_replay *rp = (struct wpantap_replay *)data;
+	struct wpantap_trace_rec *rec;
+	int budget = WPANTAP_REPLAY_BUDGET;
+	ktime_t now = ktime_get();
+	ktime_t due = 0;
+	s64 late;
+
+	spin_lock(&rp->spin);
+
+	if(!rp->running){
+		spin_unlock(&rp->spin);
+		return;
+	}
+
+	while(rp->pos < rp->len && budget > 0){
+		rec = rp->trace + rp->pos;
+		due = wpantap_replay_due(rp, rec);
+		if(ktime_after(due, now)){
+			break;
+		}
 
-	hw->flags = IEEE802154_HW_PROMISCUOUS;
-	hw->parent = dev;
+		late = ktime_to_ns(ktime_sub(now, due));
+		rp->stats.total_lateness_ns += late;
+		if(late > rp->stats.max_lateness_ns){
+			rp->stats.max_lateness_ns = late;
+		}
+		if(late > WPANTAP_REPLAY_LATE_NS){
+			rp->stats.late++;
+		}
 
-	err = ieee802154_register_hw(hw);
-	if (err)
-		goto err_reg;
+		wpantap_replay_inject(rp, rec);
 
-	mutex_lock(&fakelb_phys_lock);
-	list_add_tail(&phy->list, &fakelb_phys);
-	mutex_unlock(&fakelb_phys_lock);
+		rp->pos += WPANTAP_TRACE_REC_SIZE(rec->len);
+		rp->index++;
+		budget--;
+	}
 
-	return 0;
+	if(rp->pos >= rp->len){
+		rp->running = false;
+		rp->end = now;
+	}else if(budget == 0){
+		// more frames are due, let other softirqs run first
+		tasklet_schedule(&rp->tasklet);
+	}else{
+		hrtimer_start(&rp->timer, due, HRTIMER_MODE_ABS);
+	}
 
-err_reg:
-	ieee802154_free_hw(phy->hw);
-	return err;
+	spin_unlock(&rp->spin);
 }
 
-static void fakelb_del(struct fakelb_phy *phy)
+
+static enum hrtimer_restart wpantap_replay_timer(struct hrtimer *timer)
 {
-	list_del(&phy->list);
+	struct wpantap_replay *rp = container_of(timer, struct wpantap_replay, timer);
 
-	ieee802154_unregister_hw(phy->hw);
-	ieee802154_free_hw(phy->hw);
+	tasklet_schedule(&rp->tasklet);
+	return HRTIMER_NORESTART;
 }
 
-static int fakelb_probe(struct platform_device *pdev)
-{
-	struct fakelb_phy *phy, *tmp;
-	int err, i;
 
-	for (i = 0; i < numlbs; i++) {
-		err = fakelb_add_one(&pdev->dev);
-		if (err < 0)
-			goto err_slave;
+static void wpantap_replay_stop(struct wpantap_replay *rp)
+{
+	spin_lock_bh(&rp->spin);
+	if(rp->running){
+		rp->running = false;
+		rp->end = ktime_get();
 	}
+	spin_unlock_bh(&rp->spin);
 
-	dev_info(&pdev->dev, "wpantap: added %i fake ieee802154 tap device(s)\n", numlbs);
-	return 0;
-
-err_slave:
-	mutex_lock(&fakelb_phys_lock);
-	list_for_each_entry_safe(phy, tmp, &fakelb_phys, list)
-		fakelb_del(phy);
-	mutex_unlock(&fakelb_phys_lock);
-	return err;
+	hrtimer_cancel(&rp->timer);
+	tasklet_kill(&rp->tasklet);
 }
 
-static int fakelb_remove(struct platform_device *pdev)
+
+static int wpantap_replay_load(struct wpantap_replay *rp, struct wpantap_replay_load *req)
 {
-	struct fakelb_phy *phy, *tmp;
+	void *trace, *old;
+	bool running;
+	int err;
 
-	mutex_lock(&fakelb_phys_lock);
-	list_for_each_entry_safe(phy, tmp, &fakelb_phys, list)
-		fakelb_del(phy);
-	mutex_unlock(&fakelb_phys_lock);
-	return 0;
-}
+	if(req->len == 0 || req->len > WPANTAP_TRACE_MAX_SIZE){
+		return -EINVAL;
+	}
 
-static struct platform_device *ieee802154fake_dev;
+	trace = vmalloc(req->len);
+	if(trace == NULL){
+		printk(KERN_ERR "wpantap: unable to allocate %u bytes for replay trace\n", req->len);
+		return -ENOMEM;
+	}
 
-static struct platform_driver ieee802154fake_driver = {
-	.probe = fakelb_probe,
-	.remove = fakelb_remove,
-	.driver = {
-			.name = "ieee802154tap",
-	},
-};
+	if(copy_from_user(trace, u64_to_user_ptr(req->data), req->len)){
+		vfree(trace);
+		return -EFAULT;
+	}
 
-static int fakelb_init_module(void)
-{
-	ieee802154fake_dev = platform_device_register_simple(
-			     "ieee802154tap", -1, NULL, 0);
+	err = wpantap_trace_validate(trace, req->len);
+	if(err != 0){
+		vfree(trace);
+		return err;
+	}
 
-	//pr_warn("fakelb driver is marked as deprecated, please use mac802154_hwsim!\n");
+	mutex_lock(&rp->lock);
 
-	return platform_driver_register(&ieee802154fake_driver);
-}
+	spin_lock_bh(&rp->spin);
+	running = rp->running;
+	spin_unlock_bh(&rp->spin);
 
-static void fake_remove_module(void)
-{
-	platform_driver_unregister(&ieee802154fake_driver);
-	platform_device_unregister(ieee802154fake_dev);
+	if(running){
+		mutex_unlock(&rp->lock);
+		vfree(trace);
+		return -EBUSY;
+	}
+
+	// the tasklet is idle, the old trace can go
+	old = rp->trace;
+	rp->trace = trace;
+	rp->len = req->len;
+	rp->pos = 0;
+
+	mutex_unlock(&rp->lock);
+
+	vfree(old);
+	return 0;
 }
 
 
-static ssize_t wpantap_chr_read_iter(struct kiocb *iocb, struct iov_iter *to)
+// the frames go to the phy called name
+static int wpantap_replay_start(struct wpantap_replay *rp, struct wpantap_replay_cfg *cfg, const char *name)
 {
-	struct file *file = iocb->ki_filp;
-	ssize_t len = iov_iter_count(to);
-	ssize_t size = 0;
-	ssize_t ret;
-	int rbempty;
-	void *data;
+	int err = 0;
 
-	if(!file){
-		return -EBADFD;
+	if(cfg->mode != WPANTAP_REPLAY_TIMED && cfg->mode != WPANTAP_REPLAY_MAXRATE){
+		return -EINVAL;
 	}
-	
-	printk_dbg(KERN_DEBUG "wpantap: entering read opration\n");
-
-	while(1){
-		// busy wait for data
-		
-		//printk(KERN_DEBUG "executing read busy-wait\n");
-		spin_lock_bh(&ringbuf_spin);
-
-		rbempty = ringbuf_is_empty(&rbuf);
-		if (rbempty == 0){
-			// if there is data to fetch
-			printk_dbg(KERN_DEBUG "wpantap: readable buffer found in ring buffer\n");
-			size = ringbuf_get_first_data_size(&rbuf);
-			if (size == 0){
-				printk(KERN_ERR "wpantap: no data in the buffer to fetch\n");
-				goto term;
-			}
-			data = kmalloc_safe(size);
-			if(data == NULL){
-				printk(KERN_ERR "wpantap: unable to allocate %d bytes for reading\n", (int)size);
-				goto mem_err;
-			}
-			
-			ringbuf_copy_first_data(&rbuf, data);
-			copy_to_iter(data, size, to);
-			kfree(data);
-			
-			ringbuf_pop_data(&rbuf);
-			
-			goto term;
-		}
-		spin_unlock_bh(&ringbuf_spin);
-		schedule();
+	if(cfg->speed == 0){
+		cfg->speed = 1000;
 	}
-	
-	
-term:
-	spin_unlock_bh(&ringbuf_spin);
-	ret = min_t(ssize_t, size, len);
-	
-	if(ret > 0){
-		iocb->ki_pos = ret;
+
+	mutex_lock(&rp->lock);
+	spin_lock_bh(&rp->spin);
+
+	if(rp->trace == NULL){
+		err = -EINVAL;
+	}else if(rp->running){
+		err = -EBUSY;
+	}else{
+		rp->cfg = *cfg;
+		memcpy(rp->phy, name, WPANTAP_PHY_NAME_LEN);
+		rp->interval_ns = cfg->max_rate ? NSEC_PER_SEC / cfg->max_rate : 0;
+		rp->pos = 0;
+		rp->index = 0;
+		memset(&rp->stats, 0, sizeof(rp->stats));
+		rp->start = ktime_get();
+		rp->running = true;
 	}
-	
-	return size;
 
-mem_err:
-	spin_unlock_bh(&ringbuf_spin);
-	return -ENOMEM;
+	spin_unlock_bh(&rp->spin);
+	mutex_unlock(&rp->lock);
+
+	if(err == 0){
+		tasklet_schedule(&rp->tasklet);
+	}
+	return err;
 }
 
 
-static void rx_irqsafe(char *raw_pkt, int len) {
-	// do we need to deallocate this buffer?
-	struct sk_buff *newskb = dev_alloc_skb(len);
-	skb_put_data(newskb, raw_pkt, len);
+static void wpantap_replay_get_stats(struct wpantap_replay *rp, struct wpantap_replay_stats *stats)
+{
+	ktime_t end;
+
+	spin_lock_bh(&rp->spin);
+	*stats = rp->stats;
+	stats->running = rp->running;
+	end = rp->running ? ktime_get() : rp->end;
+	if(rp->start != 0){
+		stats->elapsed_ns = ktime_to_ns(ktime_sub(end, rp->start));
+	}
+	spin_unlock_bh(&rp->spin);
 
-	struct fakelb_phy *phy;
+	if(stats->elapsed_ns > 0){
+		stats->rate = div64_u64(stats->frames * NSEC_PER_SEC, stats->elapsed_ns);
+	}
+}
 
-	read_lock_bh(&fakelb_ifup_phys_lock);
 
-	/*Since we only have one virtual interface, we will only get one phy, that is the current phy.
-	* We may come up with better way to get the pointer of the current phy.
-	*/
-	list_for_each_entry(phy, &fakelb_ifup_phys, list_ifup) {
-		if (newskb)
-			ieee802154_rx_irqsafe(phy->hw, newskb, 0xcc);
-	}
+static void wpantap_replay_init(struct wpantap_replay *rp)
+{
+	mutex_init(&rp->lock);
+	spin_lock_init(&rp->spin);
+	hrtimer_init(&rp->timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	rp->timer.function = wpantap_replay_timer;
+	tasklet_init(&rp->tasklet, wpantap_replay_run, (unsigned long)rp);
+}
 
-	read_unlock_bh(&fakelb_ifup_phys_lock);
 
+static void wpantap_replay_deinit(struct wpantap_replay *rp)
+{
+	wpantap_replay_stop(rp);
+	vfree(rp->trace);
+	rp->trace = NULL;
 }
 
+
 static ssize_t wpantap_chr_write_iter(struct kiocb *iocb, struct iov_iter *from)
 {	
+	struct wpantap_file *tfile = iocb->ki_filp->private_data;
 	// assume the packets acquired from user space doesn't have FCS
 	int total_len = iov_iter_count(from);
+	struct sk_buff *skb;
 	
+	// mirrors are read-only
+	if(tfile->mirror != NULL){
+		return -EPERM;
+	}
+
+	// writes never sleep (atomic skb allocations, spinlocks only),
+	// so IOCB_NOWAIT needs no special case here
+	if(tfile->format == WPANTAP_FMT_META){
+		return wpantap_meta_write(tfile->wn, tfile->phy, from);
+	}
+
 	printk_dbg(KERN_DEBUG "wpantap: entering write opration-incoming size %d\n", total_len);
-	
-	printk_dbg(KERN_DEBUG "wpantap: padding incoming user packet with 2 byte FCS...\n");
-	total_len += 2;
-	
-	void *buf = kmalloc_safe(total_len);
-		
-	if(buf == NULL){
-		printk(KERN_ERR "wpantap: unable to allocate %d bytes fo writing\n", total_len);
-		return -ENOMEM;
+
+	skb = wpantap_rx_skb_from_iter(from, total_len);
+	if(IS_ERR(skb)){
+		return PTR_ERR(skb);
 	}
-	
-	// get info from user space
-	copy_from_iter(buf, total_len, from);
-	
-	// set FCS to 0
-	((char*)buf)[total_len - 1] = '\0';
-	((char*)buf)[total_len - 2] = '\0';
-	
-	rx_irqsafe(buf, total_len);
 
-	kfree(buf);	
+	rx_irqsafe_skb(tfile->wn, tfile->phy, skb);
 
-	return total_len;
+	// the FCS padded by the driver is accounted for
+	return total_len + WPANTAP_FCS_LEN;
 }
 
-static DECLARE_WAIT_QUEUE_HEAD(wpantap_chr_wait);
-
 static unsigned int wpantap_chr_poll(struct file *file, poll_table *wait){
 	
-	int rbempty;
+	struct wpantap_file *tfile = file->private_data;
 	unsigned int mask = 0;
 	
-	poll_wait(file, &wpantap_chr_wait, wait);
+	poll_wait(file, &tfile->wn->wait, wait);
 	
+	if(wpantap_readable(tfile)){
+		printk_dbg(KERN_DEBUG "wpantap: polling-data avaliable for read\n");
+		mask |= POLLIN | POLLRDNORM;
+	}else{
+		printk_dbg(KERN_DEBUG "wpantap: polling-NO data avaliable for read\n");
+	}
+
+	// a mirror is never writable
+	if(tfile->mirror != NULL){
+		return mask;
+	}
+
 	// check if the driver is writable
 	// first of all, get device pointer
 	bool suspended = false;
@@ -647,7 +2814,7 @@ static unsigned int wpantap_chr_poll(struct file *file, poll_table *wait){
 	struct fakelb_phy *phy;
 	read_lock_bh(&fakelb_ifup_phys_lock);
 
-	list_for_each_entry(phy, &fakelb_ifup_phys, list_ifup) {
+	list_for_each_entry(phy, &tfile->wn->ifup_phys, list_ifup) {
 		suspended = phy->suspended;
 	}
 
@@ -661,22 +2828,249 @@ static unsigned int wpantap_chr_poll(struct file *file, poll_table *wait){
 		printk_dbg(KERN_DEBUG "wpantap: polling-device suspended, not writable\n");
 	}
 	
-	// check if there is data in ring buffer
-	spin_lock_bh(&ringbuf_spin);
+	return mask;
+}
 
-	rbempty = ringbuf_is_empty(&rbuf);
-		
-	spin_unlock_bh(&ringbuf_spin);
-	
-	
-	if(rbempty != 1){
-		printk_dbg(KERN_DEBUG "wpantap: polling-data avaliable for read\n");
-		mask |= POLLIN | POLLRDNORM;
-	}else{
-		printk_dbg(KERN_DEBUG "wpantap: polling-NO data avaliable for read\n");
+static long wpantap_chr_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	struct wpantap_file *tfile = file->private_data;
+	struct wpantap_net *wn = tfile->wn;
+	void __user *argp = (void __user *)arg;
+	struct wpantap_mirror_stats mstats;
+	unsigned int depth;
+	unsigned int format;
+	struct wpantap_replay_load rload;
+	struct wpantap_replay_cfg rcfg;
+	struct wpantap_replay_stats rstats;
+	struct wpantap_vtime_info vinfo;
+	struct wpantap_link_info linfo;
+	struct wpantap_tunnel_info tinfo;
+	struct wpantap_alloc_stats astats;
+	struct wpantap_cpu_info cinfo;
+	struct wpantap_fq_cfg fcfg;
+	struct wpantap_fq_stats fstats;
+	struct wpantap_phy_sel psel;
+	u64 vtarget;
+	int err;
+
+	switch(cmd){
+	case WPANTAPATTACHMIRROR:
+		if(get_user(depth, (unsigned int __user *)argp)){
+			return -EFAULT;
+		}
+		return wpantap_mirror_attach(tfile, depth);
+
+	case WPANTAPGETMIRRORSTATS:
+		if(tfile->mirror == NULL){
+			return -EINVAL;
+		}
+		wpantap_mirror_get_stats(wn, tfile->mirror, &mstats);
+		if(copy_to_user(argp, &mstats, sizeof(mstats))){
+			return -EFAULT;
+		}
+		return 0;
+
+	case WPANTAPSETFORMAT:
+		if(get_user(format, (unsigned int __user *)argp)){
+			return -EFAULT;
+		}
+		if(format != WPANTAP_FMT_RAW && format != WPANTAP_FMT_PCAPNG &&
+		   format != WPANTAP_FMT_META){
+			return -EINVAL;
+		}
+		tfile->format = format;
+		// switching formats starts a new pcapng section
+		tfile->pcapng_started = false;
+		return 0;
+
+	case WPANTAPREPLAYLOAD:
+		if(copy_from_user(&rload, argp, sizeof(rload))){
+			return -EFAULT;
+		}
+		return wpantap_replay_load(&wn->replay, &rload);
+
+	case WPANTAPREPLAYSTART:
+		if(copy_from_user(&rcfg, argp, sizeof(rcfg))){
+			return -EFAULT;
+		}
+		return wpantap_replay_start(&wn->replay, &rcfg, tfile->phy);
+
+	case WPANTAPREPLAYSTOP:
+		wpantap_replay_stop(&wn->replay);
+		return 0;
+
+	case WPANTAPREPLAYSTATS:
+		wpantap_replay_get_stats(&wn->replay, &rstats);
+		if(copy_to_user(argp, &rstats, sizeof(rstats))){
+			return -EFAULT;
+		}
+		return 0;
+
+	case WPANTAPSETVTIME:
+		if(copy_from_user(&vinfo, argp, sizeof(vinfo))){
+			return -EFAULT;
+		}
+		wpantap_vtime_set(&wn->vtime, &vinfo);
+		return 0;
+
+	case WPANTAPGETVTIME:
+		wpantap_vtime_get(&wn->vtime, &vinfo);
+		if(copy_to_user(argp, &vinfo, sizeof(vinfo))){
+			return -EFAULT;
+		}
+		return 0;
+
+	case WPANTAPADVANCE:
+		if(get_user(vtarget, (u64 __user *)argp)){
+			return -EFAULT;
+		}
+		return wpantap_vtime_advance(&wn->vtime, vtarget);
+
+	case WPANTAPSETLINK:
+		if(copy_from_user(&linfo, argp, sizeof(linfo))){
+			return -EFAULT;
+		}
+		return wpantap_link_set(wn, &linfo);
+
+	case WPANTAPGETLINK:
+		if(copy_from_user(&linfo, argp, sizeof(linfo))){
+			return -EFAULT;
+		}
+		err = wpantap_link_get(wn, &linfo);
+		if(err != 0){
+			return err;
+		}
+		if(copy_to_user(argp, &linfo, sizeof(linfo))){
+			return -EFAULT;
+		}
+		return 0;
+
+	case WPANTAPSETTUNNEL:
+		if(copy_from_user(&tinfo, argp, sizeof(tinfo))){
+			return -EFAULT;
+		}
+		return wpantap_tunnel_set(wn, &tinfo);
+
+	case WPANTAPGETTUNNEL:
+		if(copy_from_user(&tinfo, argp, sizeof(tinfo))){
+			return -EFAULT;
+		}
+		err = wpantap_tunnel_get(wn, &tinfo);
+		if(err != 0){
+			return err;
+		}
+		if(copy_to_user(argp, &tinfo, sizeof(tinfo))){
+			return -EFAULT;
+		}
+		return 0;
+
+	case WPANTAPSETCPU:
+		if(copy_from_user(&cinfo, argp, sizeof(cinfo))){
+			return -EFAULT;
+		}
+		return wpantap_cpu_set(wn, &cinfo);
+
+	case WPANTAPGETCPU:
+		if(copy_from_user(&cinfo, argp, sizeof(cinfo))){
+			return -EFAULT;
+		}
+		err = wpantap_cpu_get(wn, &cinfo);
+		if(err != 0){
+			return err;
+		}
+		if(copy_to_user(argp, &cinfo, sizeof(cinfo))){
+			return -EFAULT;
+		}
+		return 0;
+
+	case WPANTAPSETFQ:
+		if(copy_from_user(&fcfg, argp, sizeof(fcfg))){
+			return -EFAULT;
+		}
+		return wpantap_fq_set(wn, &fcfg);
+
+	case WPANTAPGETFQSTATS:
+		if(copy_from_user(&fstats, argp, sizeof(fstats))){
+			return -EFAULT;
+		}
+		err = wpantap_fq_get_stats(wn, &fstats);
+		if(err != 0){
+			return err;
+		}
+		if(copy_to_user(argp, &fstats, sizeof(fstats))){
+			return -EFAULT;
+		}
+		return 0;
+
+	case WPANTAPSETPHY:
+		if(copy_from_user(&psel, argp, sizeof(psel))){
+			return -EFAULT;
+		}
+		return wpantap_file_set_phy(tfile, &psel);
+
+	case WPANTAPGETPHY:
+		memcpy(psel.phy, tfile->phy, WPANTAP_PHY_NAME_LEN);
+		if(copy_to_user(argp, &psel, sizeof(psel))){
+			return -EFAULT;
+		}
+		return 0;
+
+	case WPANTAPGETALLOCSTATS:
+		wpantap_alloc_get_stats(&astats);
+		if(copy_to_user(argp, &astats, sizeof(astats))){
+			return -EFAULT;
+		}
+		return 0;
+
+	default:
+		return -ENOTTY;
 	}
+}
 
-	return mask;
+static int wpantap_chr_open(struct inode *inode, struct file *file)
+{
+	struct wpantap_file *tfile;
+	struct net *net = current->nsproxy->net_ns;
+	int err;
+
+	tfile = kzalloc(sizeof(*tfile), GFP_KERNEL);
+	if(tfile == NULL){
+		printk(KERN_ERR "wpantap: unable to allocate file state\n");
+		return -ENOMEM;
+	}
+
+	// the first open from a namespace creates its phys
+	tfile->wn = wpantap_pernet(net);
+	mutex_lock(&fakelb_phys_lock);
+	err = fakelb_add_all(&ieee802154fake_dev->dev, tfile->wn);
+	mutex_unlock(&fakelb_phys_lock);
+	if(err != 0){
+		kfree(tfile);
+		return err;
+	}
+
+	// the namespace, and so the instance, lives as long as the fd
+	get_net(net);
+	file->private_data = tfile;
+	// neither read nor write sleeps with IOCB_NOWAIT, io_uring can
+	// complete them inline instead of punting them to a worker thread
+#ifdef FMODE_NOWAIT
+	file->f_mode |= FMODE_NOWAIT;
+#endif
+	return 0;
+}
+
+static int wpantap_chr_release(struct inode *inode, struct file *file)
+{
+	struct wpantap_file *tfile = file->private_data;
+
+	if(tfile->mirror != NULL){
+		wpantap_mirror_detach(tfile->wn, tfile->mirror);
+	}
+	put_net(tfile->wn->net);
+	kfree(tfile);
+
+	return 0;
 }
 
 static const struct file_operations wpantap_fops = {
@@ -685,7 +3079,10 @@ static const struct file_operations wpantap_fops = {
 	.read_iter  = wpantap_chr_read_iter,
 	.write_iter = wpantap_chr_write_iter,
 	.poll	 = wpantap_chr_poll,
-	//.unlocked_ioctl	= tun_chr_ioctl,
+	.unlocked_ioctl	= wpantap_chr_ioctl,
+	.compat_ioctl	= wpantap_chr_ioctl,
+	.open	 = wpantap_chr_open,
+	.release = wpantap_chr_release,
 };
 
 static struct miscdevice wpantap_miscdev = {
@@ -713,16 +3110,73 @@ static void file_dev_deinit(void)
 
 
 
+static __net_init int wpantap_net_init(struct net *net)
+{
+	struct wpantap_net *wn = wpantap_pernet(net);
+	int err;
+
+	wn->net = net;
+
+	// fakelb_hw_xmit queues every frame up to WPANTAP_FRAME_MAX bytes
+	BUILD_BUG_ON(sizeof(int) + sizeof(u64) + WPANTAP_FRAME_MAX > RINGBUF_SIZE - 1);
+	err = ringbuf_init(&wn->rbuf, RINGBUF_SIZE);
+	if(err != 0){
+		return err;
+	}
+	spin_lock_init(&wn->ringbuf_spin);
+	init_waitqueue_head(&wn->wait);
+
+	INIT_LIST_HEAD(&wn->mirrors);
+	spin_lock_init(&wn->mirrors_spin);
+
+	wpantap_replay_init(&wn->replay);
+	wpantap_vtime_init(&wn->vtime);
+	wpantap_fq_init(&wn->fq);
+
+	INIT_LIST_HEAD(&wn->phys);
+	INIT_LIST_HEAD(&wn->ifup_phys);
+	return 0;
+}
+
+static __net_exit void wpantap_net_exit(struct net *net)
+{
+	struct wpantap_net *wn = wpantap_pernet(net);
+
+	// no fd is left, only the phys can still inject
+	wpantap_replay_deinit(&wn->replay);
+	wpantap_vtime_deinit(&wn->vtime);
+
+	mutex_lock(&fakelb_phys_lock);
+	fakelb_del_all(wn);
+	mutex_unlock(&fakelb_phys_lock);
+
+	wpantap_fq_deinit(&wn->fq);
+	ringbuf_deinit(&wn->rbuf);
+}
+
+// a device subsystem, the phys are gone before the wpan interfaces of a
+// dying namespace are cleaned up
+static struct pernet_operations wpantap_net_ops = {
+	.init = wpantap_net_init,
+	.exit = wpantap_net_exit,
+	.id = &wpantap_net_id,
+	.size = sizeof(struct wpantap_net),
+};
+
+
 static __init int wpantap_init(void)
 {	
 	printk_dbg(KERN_DEBUG "wpantap: prepare to initialize wpantap...\n");
 	int err;
+	err = wpantap_alloc_init();
+	if(err != 0) goto err_alloc;
+
+	err = register_pernet_device(&wpantap_net_ops);
+	if(err != 0) goto err_pernet;
+
 	err = fakelb_init_module();
 	if(err != 0) goto err_fakelb;
 
-	err = ringbuf_init(&rbuf);
-	if(err != 0) goto err_ringbuf;
-	
 	err = file_dev_init();
 	if(err != 0) goto err_miscdev;
 	
@@ -732,18 +3186,22 @@ static __init int wpantap_init(void)
 
 err_miscdev:
 	file_dev_deinit();
-err_ringbuf:
-	ringbuf_deinit(&rbuf);
 err_fakelb:
+	unregister_pernet_device(&wpantap_net_ops);
 	fake_remove_module();
+err_pernet:
+	wpantap_alloc_deinit();
+err_alloc:
 	return err;
 }
 
 static __exit void wpantap_deinit(void)
 {
-	fake_remove_module();
-	ringbuf_deinit(&rbuf);
 	file_dev_deinit();
+	// removes the phys of every instance
+	unregister_pernet_device(&wpantap_net_ops);
+	fake_remove_module();
+	wpantap_alloc_deinit();
 	printk(KERN_INFO "wpantap: exited succesfully\n");
 }
 
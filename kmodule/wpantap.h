@@ -0,0 +1,328 @@
+/* SPDX-License-Identifier: GPL-2.0-only WITH Linux-syscall-note */
+/*
+ * WPAN TAP interface - user space API
+ *
+ * Shared between the kernel module and the programs under ./test.
+ */
+
+#ifndef _WPANTAP_H
+#define _WPANTAP_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define WPANTAP_DEV_PATH "/dev/net/wpantap"
+
+// longest frame the driver handles (SUN PHY PSDU), including the 2 byte FCS
+#define WPANTAP_FRAME_MAX 2047
+
+// ioctl commands for /dev/net/wpantap
+#define WPANTAP_IOC_MAGIC 'W'
+
+// turn this fd into a read-only mirror, argument is the queue depth in frames
+#define WPANTAPATTACHMIRROR   _IOW(WPANTAP_IOC_MAGIC, 1, unsigned int)
+#define WPANTAPGETMIRRORSTATS _IOR(WPANTAP_IOC_MAGIC, 2, struct wpantap_mirror_stats)
+
+// select the read format of this fd, argument is one of WPANTAP_FMT_*
+#define WPANTAPSETFORMAT      _IOW(WPANTAP_IOC_MAGIC, 3, unsigned int)
+
+// read formats
+#define WPANTAP_FMT_RAW    0	// one frame per read, as sent by the stack (default)
+#define WPANTAP_FMT_PCAPNG 1	// a pcapng stream with one block per frame
+#define WPANTAP_FMT_META   2	// struct wpantap_meta records, for reads and writes
+
+// load a replay trace, start and stop it, and read its statistics
+#define WPANTAPREPLAYLOAD     _IOW(WPANTAP_IOC_MAGIC, 4, struct wpantap_replay_load)
+#define WPANTAPREPLAYSTART    _IOW(WPANTAP_IOC_MAGIC, 5, struct wpantap_replay_cfg)
+#define WPANTAPREPLAYSTOP     _IO(WPANTAP_IOC_MAGIC, 6)
+#define WPANTAPREPLAYSTATS    _IOR(WPANTAP_IOC_MAGIC, 7, struct wpantap_replay_stats)
+
+// virtual time mode: set/get the virtual clock and advance it
+#define WPANTAPSETVTIME       _IOW(WPANTAP_IOC_MAGIC, 8, struct wpantap_vtime_info)
+#define WPANTAPGETVTIME       _IOR(WPANTAP_IOC_MAGIC, 9, struct wpantap_vtime_info)
+#define WPANTAPADVANCE        _IOW(WPANTAP_IOC_MAGIC, 10, __u64)
+
+// link emulation profile of a phy
+#define WPANTAPSETLINK        _IOW(WPANTAP_IOC_MAGIC, 11, struct wpantap_link_info)
+#define WPANTAPGETLINK        _IOWR(WPANTAP_IOC_MAGIC, 12, struct wpantap_link_info)
+
+// in-kernel UDP tunnel of a phy
+#define WPANTAPSETTUNNEL      _IOW(WPANTAP_IOC_MAGIC, 13, struct wpantap_tunnel_info)
+#define WPANTAPGETTUNNEL      _IOWR(WPANTAP_IOC_MAGIC, 14, struct wpantap_tunnel_info)
+
+// counters of the frame buffers of read()
+#define WPANTAPGETALLOCSTATS  _IOR(WPANTAP_IOC_MAGIC, 15, struct wpantap_alloc_stats)
+
+// preferred CPU of the injection into a phy
+#define WPANTAPSETCPU         _IOW(WPANTAP_IOC_MAGIC, 16, struct wpantap_cpu_info)
+#define WPANTAPGETCPU         _IOWR(WPANTAP_IOC_MAGIC, 17, struct wpantap_cpu_info)
+
+// fair queueing of the frames sent by the stack, and its per-flow counters
+#define WPANTAPSETFQ          _IOW(WPANTAP_IOC_MAGIC, 18, struct wpantap_fq_cfg)
+#define WPANTAPGETFQSTATS     _IOWR(WPANTAP_IOC_MAGIC, 19, struct wpantap_fq_stats)
+
+// phy that the frames written to this fd are injected into
+#define WPANTAPSETPHY         _IOW(WPANTAP_IOC_MAGIC, 20, struct wpantap_phy_sel)
+#define WPANTAPGETPHY         _IOR(WPANTAP_IOC_MAGIC, 21, struct wpantap_phy_sel)
+
+// default and maximum depth of a mirror queue (in frames)
+#define WPANTAP_MIRROR_DEPTH_DEFAULT 256
+#define WPANTAP_MIRROR_DEPTH_MAX     65536
+
+struct wpantap_mirror_stats {
+	__u32 depth;	// configured queue depth
+	__u32 queued;	// frames currently waiting to be read
+	__u64 frames;	// frames queued since attach
+	__u64 drops;	// frames dropped because the queue was full
+};
+
+/*
+ * Metadata format (WPANTAP_FMT_META)
+ *
+ * Every frame is preceded by a struct wpantap_meta and padded to
+ * WPANTAP_META_ALIGN bytes. A read returns as many records as fit in the
+ * buffer, a write may carry several records.
+ */
+#define WPANTAP_META_ALIGN 8
+#define WPANTAP_META_REC_SIZE(len) \
+	((sizeof(struct wpantap_meta) + (len) + WPANTAP_META_ALIGN - 1) & ~(WPANTAP_META_ALIGN - 1))
+
+struct wpantap_meta {
+	__u64 tstamp_ns;	// read: capture time, write: delivery time in virtual time mode
+	__u32 len;		// frame length, with FCS when read, without FCS when written
+	__u32 flags;
+};
+
+/*
+ * Virtual time mode
+ *
+ * Frames read are stamped with the virtual clock instead of the wall clock.
+ * Frames written in the metadata format are held back until the clock is
+ * advanced past their delivery time, and released in time order (frames
+ * with the same time keep the order in which they were written).
+ */
+#define WPANTAP_VTIME_QUEUE_MAX 65536
+
+struct wpantap_vtime_info {
+	__u64 now_ns;		// the virtual clock
+	__u32 enabled;
+	__u32 queued;		// frames waiting for their delivery time (get only)
+};
+
+/*
+ * Link emulation
+ *
+ * A profile applies to the frames injected into a phy (written, replayed
+ * or released by the virtual clock): random loss, a fixed delay plus a
+ * uniformly distributed jitter, and optionally the airtime of the frame at
+ * the bitrate of the current page and channel. Frames are never reordered.
+ */
+#define WPANTAP_PHY_NAME_LEN 16
+#define WPANTAP_LINK_QUEUE_MAX 4096
+
+// link flags
+#define WPANTAP_LINK_AIRTIME 0x1	// serialize frames at the PHY bitrate
+
+struct wpantap_link_info {
+	char phy[WPANTAP_PHY_NAME_LEN];	// e.g. "phy0", empty means every phy (set only)
+	__u32 loss_ppm;		// loss probability in parts per million
+	__u32 delay_us;		// fixed delay
+	__u32 jitter_us;	// extra delay between 0 and jitter_us
+	__u32 flags;		// WPANTAP_LINK_*
+	// get only
+	__u32 bitrate;		// bit/s of the current page and channel
+	__u32 queued;		// frames waiting for delivery
+	__u64 delivered;
+	__u64 lost;		// frames dropped by the loss probability
+	__u64 drops;		// frames dropped because the link or injection queue was full
+};
+
+/*
+ * Fair queueing
+ *
+ * With fair queueing on, the frames sent by the stack wait in one queue
+ * per source address (a flow) instead of the shared FIFO, and read() takes
+ * them in deficit round robin order: each backlogged flow may send quantum
+ * bytes per round. A flow holds at most depth frames; its new frames are
+ * dropped beyond that, so a flooding node only loses its own frames and
+ * the others keep their latency. Beyond WPANTAP_FQ_FLOWS_MAX sources, a
+ * new source takes over the flow that has been empty the longest. Turning
+ * fair queueing off drops the frames still queued and forgets the flows.
+ */
+#define WPANTAP_FQ_QUANTUM_DEFAULT 256
+#define WPANTAP_FQ_QUANTUM_MIN     64
+#define WPANTAP_FQ_DEPTH_DEFAULT   64
+#define WPANTAP_FQ_DEPTH_MAX       4096
+#define WPANTAP_FQ_FLOWS_MAX       1024
+
+// address modes of a flow, as in the frame control field
+#define WPANTAP_FQ_ADDR_NONE  0	// frames without source address (and malformed ones)
+#define WPANTAP_FQ_ADDR_SHORT 2
+#define WPANTAP_FQ_ADDR_EXT   3
+
+struct wpantap_fq_cfg {
+	__u32 enabled;
+	__u32 quantum;		// bytes per round, 0 for the default
+	__u32 depth;		// frames per flow, 0 for the default
+	__u32 reserved;
+};
+
+struct wpantap_fq_flow_stats {
+	__u64 addr;		// short or extended source address
+	__u16 pan;		// source PAN of a short address
+	__u8 mode;		// WPANTAP_FQ_ADDR_*
+	__u8 reserved;
+	__u32 queued;
+	__u64 frames;		// frames queued
+	__u64 bytes;
+	__u64 drops;		// frames dropped because the flow was full
+};
+
+struct wpantap_fq_stats {
+	// set: user pointer to an array of max_flows struct wpantap_fq_flow_stats
+	__u64 flows;
+	__u32 max_flows;
+	// get
+	__u32 nflows;		// flows known, at most max_flows of them are copied
+	__u32 enabled;
+	__u32 quantum;
+	__u32 depth;
+	__u32 queued;		// frames queued over all flows
+	__u64 drops;		// frames dropped because every flow was backlogged (or no memory)
+};
+
+/*
+ * Injection CPU
+ *
+ * Frames injected into a phy are handed to the stack by a per-phy tasklet.
+ * By default it runs on the CPU of the writer; with a preferred CPU it is
+ * scheduled there instead, so that the stack processing of the frames and
+ * the wakeup of their socket readers stay on one CPU. The tasklet queue
+ * holds at most WPANTAP_INJECT_QUEUE_MAX frames, more are dropped.
+ */
+#define WPANTAP_CPU_ANY -1
+#define WPANTAP_INJECT_QUEUE_MAX 4096
+
+struct wpantap_cpu_info {
+	char phy[WPANTAP_PHY_NAME_LEN];	// e.g. "phy0", empty means every phy (set only)
+	__s32 cpu;		// preferred CPU, or WPANTAP_CPU_ANY
+	// get only
+	__s32 last_cpu;		// CPU that delivered the last batch, -1 before the first
+	__u32 queued;		// frames waiting for the tasklet
+	__u32 reserved;
+	__u64 drops;		// frames dropped because the queue was full
+};
+
+/*
+ * Write target
+ *
+ * With numlbs > 1 an instance has several phys. The frames written to an
+ * fd, raw or as WPANTAP_FMT_META records, go to the phy selected on that
+ * fd, and the frames of a replay to the phy selected on the fd that
+ * started it. Without a selection they go to the first phy that is up.
+ */
+struct wpantap_phy_sel {
+	char phy[WPANTAP_PHY_NAME_LEN];	// e.g. "phy0", empty means the first phy that is up
+};
+
+/*
+ * UDP tunnel
+ *
+ * A phy with a tunnel sends every frame of the stack to each remote
+ * endpoint as one UDP datagram (the frame with its FCS, like the VPN
+ * programs), and injects the datagrams received on its local port. The
+ * socket lives in the network namespace of the instance of the phy (the
+ * one the fd was opened in) and goes away with it. IPv4 only.
+ */
+#define WPANTAP_TUNNEL_REMOTES_MAX 16
+
+// tunnel flags
+#define WPANTAP_TUNNEL_RING 0x1	// also queue the tunneled frames for read()
+
+struct wpantap_tunnel_remote {
+	__be32 addr;		// IPv4 address, network byte order
+	__u16 port;		// host byte order
+	__u16 reserved;
+};
+
+struct wpantap_tunnel_info {
+	char phy[WPANTAP_PHY_NAME_LEN];	// e.g. "phy0", empty means the first phy
+	__u16 local_port;	// host byte order, 0 removes the tunnel
+	__u16 nremotes;
+	__u32 flags;		// WPANTAP_TUNNEL_*
+	struct wpantap_tunnel_remote remotes[WPANTAP_TUNNEL_REMOTES_MAX];
+	// get only
+	__u64 tx_frames;	// datagrams sent, one per remote
+	__u64 tx_errors;	// no route or no memory
+	__u64 rx_frames;
+	__u64 rx_errors;	// datagrams that are not a frame
+};
+
+/*
+ * Frame buffers
+ *
+ * read() copies each frame off the queue into a buffer of a slab cache
+ * sized for 802.15.4 frames, or of a second one sized for the longest SUN
+ * frame. The counters are global to the module.
+ */
+struct wpantap_alloc_stats {
+	__u32 small_size;	// object size of the 802.15.4 cache, in bytes
+	__u32 large_size;	// object size of the SUN cache, in bytes
+	__u64 allocs;
+	__u64 large_allocs;	// allocations from the SUN cache
+	__u64 failures;
+	__u64 in_use;		// buffers not freed yet
+};
+
+/*
+ * Replay traces
+ *
+ * A trace is a sequence of records packed back to back, each one is a
+ * struct wpantap_trace_rec followed by len bytes of frame (without FCS,
+ * like the frames given to write()), padded to WPANTAP_TRACE_ALIGN bytes.
+ */
+#define WPANTAP_TRACE_ALIGN 8
+#define WPANTAP_TRACE_MAX_SIZE (64 << 20)
+#define WPANTAP_TRACE_REC_SIZE(len) \
+	((sizeof(struct wpantap_trace_rec) + (len) + WPANTAP_TRACE_ALIGN - 1) & ~(WPANTAP_TRACE_ALIGN - 1))
+
+struct wpantap_trace_rec {
+	__u64 offset_ns;	// time since the start of the trace, non-decreasing
+	__u32 len;		// frame length
+	__u32 reserved;
+};
+
+struct wpantap_replay_load {
+	__u64 data;		// user pointer to the trace
+	__u32 len;		// size of the trace in bytes
+	__u32 reserved;
+};
+
+// replay modes
+#define WPANTAP_REPLAY_TIMED   0	// keep the original timing, scaled by speed
+#define WPANTAP_REPLAY_MAXRATE 1	// ignore the timing, inject at max_rate
+
+struct wpantap_replay_cfg {
+	__u32 mode;		// WPANTAP_REPLAY_*
+	__u32 speed;		// timed mode: speed multiplier in 1/1000 (1000 is real time)
+	__u32 max_rate;		// max-rate mode: frames per second, 0 is unlimited
+	__u32 reserved;
+};
+
+// frames injected later than this count as late
+#define WPANTAP_REPLAY_LATE_NS 100000
+
+struct wpantap_replay_stats {
+	__u32 running;
+	__u32 reserved;
+	__u64 frames;		// frames injected
+	__u64 bytes;		// bytes injected
+	__u64 drops;		// frames that could not be allocated
+	__u64 elapsed_ns;	// time since the start of the replay
+	__u64 rate;		// achieved frames per second
+	__u64 late;		// frames injected more than WPANTAP_REPLAY_LATE_NS late
+	__u64 max_lateness_ns;
+	__u64 total_lateness_ns;
+};
+
+#endif /* _WPANTAP_H */
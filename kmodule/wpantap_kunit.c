@@ -0,0 +1,373 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * KUnit suite of the WPAN TAP data path
+ *
+ * Exercises the ring buffer (ringbuf.h), the skb helpers and the metadata
+ * record check of the injection paths (wpantap_skb.h) and the due time of
+ * the emulated link (wpantap_link.h) on their own, without any hardware or
+ * loaded driver. fakelb_hw_xmit, wpantap_chr_write_iter and the inject and
+ * replay paths are not called; they need a registered phy and are covered
+ * by the programs under ./test.
+ *
+ * The perf_* cases report frames per second and fail below a threshold,
+ * set low enough to pass on UML and QEMU and only catch large regressions.
+ * The thresholds are module parameters.
+ */
+
+#include <kunit/test.h>
+#include <linux/module.h>
+#include <linux/ktime.h>
+#include <linux/uio.h>
+
+#include "wpantap.h"
+#include "ringbuf.h"
+#include "wpantap_skb.h"
+#include "wpantap_link.h"
+
+#define KUNIT_FRAMES 100000
+#define KUNIT_FRAME_LEN 41
+
+static unsigned int min_enqueue_fps = 1000000;
+module_param(min_enqueue_fps, uint, 0644);
+MODULE_PARM_DESC(min_enqueue_fps, " minimum ring enqueue rate");
+
+static unsigned int min_dequeue_fps = 1000000;
+module_param(min_dequeue_fps, uint, 0644);
+MODULE_PARM_DESC(min_dequeue_fps, " minimum ring dequeue rate");
+
+static unsigned int min_write_skb_fps = 200000;
+module_param(min_write_skb_fps, uint, 0644);
+MODULE_PARM_DESC(min_write_skb_fps, " minimum rate of skb construction from a user buffer");
+
+
+static void wpantap_kunit_fill(u8 *frame, int len, u32 seq)
+{
+	int i;
+
+	for(i = 0; i < len; ++i){
+		frame[i] = (u8)(seq * 31 + i);
+	}
+}
+
+
+static u64 wpantap_kunit_fps(struct kunit *test, const char *what, u64 frames, u64 ns)
+{
+	u64 fps = ns ? div64_u64(frames * NSEC_PER_SEC, ns) : frames * NSEC_PER_SEC;
+
+	kunit_info(test, "%s: %llu frames in %llu ns, %llu fps\n", what, frames, ns, fps);
+	return fps;
+}
+
+
+// one block goes in and comes out unchanged, with its timestamp
+static void wpantap_kunit_ring_roundtrip(struct kunit *test)
+{
+	struct ringbuf_t rb;
+	u8 frame[KUNIT_FRAME_LEN], out[sizeof(u64) + KUNIT_FRAME_LEN];
+	u64 tstamp = 123456789;
+
+	KUNIT_ASSERT_EQ(test, ringbuf_init(&rb, RINGBUF_SIZE), 0);
+	wpantap_kunit_fill(frame, sizeof(frame), 1);
+
+	KUNIT_EXPECT_EQ(test, ringbuf_is_empty(&rb), 1);
+	KUNIT_EXPECT_EQ(test, ringbuf_insert_data2(&rb, sizeof(tstamp), &tstamp, sizeof(frame), frame), 0);
+	KUNIT_EXPECT_EQ(test, ringbuf_bytes_used(&rb), (int)(sizeof(int) + sizeof(out)));
+	KUNIT_EXPECT_EQ(test, ringbuf_get_first_data_size(&rb), (int)sizeof(out));
+	KUNIT_EXPECT_EQ(test, ringbuf_copy_first_data(&rb, out), (int)sizeof(out));
+	KUNIT_EXPECT_EQ(test, memcmp(out, &tstamp, sizeof(tstamp)), 0);
+	KUNIT_EXPECT_EQ(test, memcmp(out + sizeof(tstamp), frame, sizeof(frame)), 0);
+	KUNIT_EXPECT_EQ(test, ringbuf_pop_data(&rb), 0);
+	KUNIT_EXPECT_EQ(test, ringbuf_is_empty(&rb), 1);
+
+	ringbuf_deinit(&rb);
+}
+
+
+// blocks of odd sizes in a small ring wrap around the end, size included
+static void wpantap_kunit_ring_wraparound(struct kunit *test)
+{
+	struct ringbuf_t rb;
+	u8 frame[32], out[32];
+	u32 seq;
+	int len;
+
+	KUNIT_ASSERT_EQ(test, ringbuf_init(&rb, 61), 0);
+
+	for(seq = 0; seq < 1000; ++seq){
+		len = 1 + seq % sizeof(frame);
+		wpantap_kunit_fill(frame, len, seq);
+
+		KUNIT_ASSERT_EQ(test, ringbuf_insert_data2(&rb, 0, NULL, len, frame), 0);
+		KUNIT_ASSERT_EQ(test, ringbuf_copy_first_data(&rb, out), len);
+		KUNIT_ASSERT_EQ(test, memcmp(out, frame, len), 0);
+		KUNIT_ASSERT_EQ(test, ringbuf_pop_data(&rb), 0);
+		KUNIT_ASSERT_EQ(test, ringbuf_is_empty(&rb), 1);
+	}
+
+	ringbuf_deinit(&rb);
+}
+
+
+// a full ring drops its oldest blocks and rejects blocks it cannot hold
+static void wpantap_kunit_ring_evict(struct kunit *test)
+{
+	struct ringbuf_t rb;
+	u8 frame[KUNIT_FRAME_LEN], out[KUNIT_FRAME_LEN];
+	int block = sizeof(int) + KUNIT_FRAME_LEN;
+	int fit, i;
+	u32 seq;
+
+	KUNIT_ASSERT_EQ(test, ringbuf_init(&rb, RINGBUF_SIZE), 0);
+	fit = rb.capacity / block;
+
+	for(seq = 0; seq < fit + 10; ++seq){
+		wpantap_kunit_fill(frame, sizeof(frame), seq);
+		KUNIT_ASSERT_EQ(test, ringbuf_insert_data2(&rb, 0, NULL, sizeof(frame), frame), 0);
+	}
+	KUNIT_EXPECT_EQ(test, ringbuf_bytes_used(&rb), fit * block);
+
+	// the 10 oldest frames are gone
+	for(i = 0; i < fit; ++i){
+		wpantap_kunit_fill(frame, sizeof(frame), 10 + i);
+		KUNIT_ASSERT_EQ(test, ringbuf_copy_first_data(&rb, out), KUNIT_FRAME_LEN);
+		KUNIT_EXPECT_EQ(test, memcmp(out, frame, sizeof(frame)), 0);
+		KUNIT_ASSERT_EQ(test, ringbuf_pop_data(&rb), 0);
+	}
+	KUNIT_EXPECT_EQ(test, ringbuf_is_empty(&rb), 1);
+
+	KUNIT_EXPECT_NE(test, ringbuf_insert_data2(&rb, 0, NULL, rb.capacity, frame), 0);
+	KUNIT_EXPECT_EQ(test, ringbuf_is_empty(&rb), 1);
+
+	ringbuf_deinit(&rb);
+}
+
+
+// the driver ring takes the longest frame with its capture time, also
+// when it has to evict queued frames for it
+static void wpantap_kunit_ring_max_frame(struct kunit *test)
+{
+	struct ringbuf_t rb;
+	u8 *frame;
+	u64 tstamp = 1;
+	int i;
+
+	frame = kunit_kzalloc(test, WPANTAP_FRAME_MAX, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, frame);
+	KUNIT_ASSERT_EQ(test, ringbuf_init(&rb, RINGBUF_SIZE), 0);
+
+	KUNIT_EXPECT_EQ(test, ringbuf_insert_data2(&rb, sizeof(tstamp), &tstamp, WPANTAP_FRAME_MAX, frame), 0);
+	for(i = 0; i < 3; ++i){
+		KUNIT_EXPECT_EQ(test, ringbuf_insert_data2(&rb, sizeof(tstamp), &tstamp, KUNIT_FRAME_LEN, frame), 0);
+	}
+	KUNIT_EXPECT_EQ(test, ringbuf_insert_data2(&rb, sizeof(tstamp), &tstamp, WPANTAP_FRAME_MAX, frame), 0);
+	// only the first long frame made room
+	KUNIT_EXPECT_EQ(test, ringbuf_get_first_data_size(&rb), (int)(sizeof(tstamp) + KUNIT_FRAME_LEN));
+
+	ringbuf_deinit(&rb);
+}
+
+
+// wpantap_rx_skb_copy appends a zero FCS to frames from user space
+static void wpantap_kunit_skb_fcs(struct kunit *test)
+{
+	u8 frame[KUNIT_FRAME_LEN];
+	struct sk_buff *skb;
+
+	wpantap_kunit_fill(frame, sizeof(frame), 7);
+	skb = wpantap_rx_skb_copy(frame, sizeof(frame));
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, skb);
+
+	KUNIT_EXPECT_EQ(test, skb->len, (unsigned int)(sizeof(frame) + WPANTAP_FCS_LEN));
+	KUNIT_EXPECT_EQ(test, memcmp(skb->data, frame, sizeof(frame)), 0);
+	KUNIT_EXPECT_EQ(test, skb->data[sizeof(frame)], 0);
+	KUNIT_EXPECT_EQ(test, skb->data[sizeof(frame) + 1], 0);
+
+	kfree_skb(skb);
+}
+
+
+// wpantap_rx_skb_from_iter, the skb of a write, and its length checks
+static void wpantap_kunit_skb_from_iter(struct kunit *test)
+{
+	u8 frame[KUNIT_FRAME_LEN];
+	struct kvec kv = { .iov_base = frame, .iov_len = sizeof(frame) };
+	struct iov_iter iter;
+	struct sk_buff *skb;
+
+	wpantap_kunit_fill(frame, sizeof(frame), 9);
+
+	iov_iter_kvec(&iter, WRITE, &kv, 1, sizeof(frame));
+	skb = wpantap_rx_skb_from_iter(&iter, sizeof(frame));
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, skb);
+	KUNIT_EXPECT_EQ(test, skb->len, (unsigned int)(sizeof(frame) + WPANTAP_FCS_LEN));
+	KUNIT_EXPECT_EQ(test, memcmp(skb->data, frame, sizeof(frame)), 0);
+	KUNIT_EXPECT_EQ(test, iov_iter_count(&iter), (size_t)0);
+	kfree_skb(skb);
+
+	// more than the iterator holds
+	iov_iter_kvec(&iter, WRITE, &kv, 1, sizeof(frame));
+	KUNIT_EXPECT_EQ(test, PTR_ERR(wpantap_rx_skb_from_iter(&iter, sizeof(frame) + 1)), (long)-EFAULT);
+
+	iov_iter_kvec(&iter, WRITE, &kv, 1, sizeof(frame));
+	KUNIT_EXPECT_EQ(test, PTR_ERR(wpantap_rx_skb_from_iter(&iter, 0)), (long)-EINVAL);
+	KUNIT_EXPECT_EQ(test, PTR_ERR(wpantap_rx_skb_from_iter(&iter, WPANTAP_FRAME_MAX)), (long)-EINVAL);
+}
+
+
+// wpantap_meta_rec_check, the validation of each record of a metadata write
+static void wpantap_kunit_meta_rec_check(struct kunit *test)
+{
+	struct wpantap_meta meta = { .len = KUNIT_FRAME_LEN };
+	size_t body = WPANTAP_META_REC_SIZE(KUNIT_FRAME_LEN) - sizeof(meta);
+
+	// the frame and its padding follow the header
+	KUNIT_EXPECT_EQ(test, wpantap_meta_rec_check(&meta, body),
+			(ssize_t)WPANTAP_META_REC_SIZE(KUNIT_FRAME_LEN));
+	KUNIT_EXPECT_EQ(test, wpantap_meta_rec_check(&meta, body + 64),
+			(ssize_t)WPANTAP_META_REC_SIZE(KUNIT_FRAME_LEN));
+	// the padding of the last record is not optional
+	KUNIT_EXPECT_EQ(test, wpantap_meta_rec_check(&meta, KUNIT_FRAME_LEN), (ssize_t)-EINVAL);
+	KUNIT_EXPECT_EQ(test, wpantap_meta_rec_check(&meta, 0), (ssize_t)-EINVAL);
+
+	meta.len = 0;
+	KUNIT_EXPECT_EQ(test, wpantap_meta_rec_check(&meta, body), (ssize_t)-EINVAL);
+
+	// the longest frame leaves room for the FCS
+	meta.len = WPANTAP_FRAME_MAX - WPANTAP_FCS_LEN;
+	body = WPANTAP_META_REC_SIZE(meta.len) - sizeof(meta);
+	KUNIT_EXPECT_EQ(test, wpantap_meta_rec_check(&meta, body), (ssize_t)WPANTAP_META_REC_SIZE(meta.len));
+	meta.len++;
+	KUNIT_EXPECT_EQ(test, wpantap_meta_rec_check(&meta, body + WPANTAP_META_ALIGN), (ssize_t)-EINVAL);
+}
+
+
+// wpantap_link_due serializes the airtime and never reorders frames
+static void wpantap_kunit_link_due(struct kunit *test)
+{
+	ktime_t busy_until = 0, last_due = 0;
+	ktime_t now = 1000000, due, prev;
+	u64 jitter[] = { 900, 0, 500, 100, 0, 700 };
+	int i;
+
+	// two frames written at once go on air one after the other
+	KUNIT_EXPECT_EQ(test, wpantap_link_due(now, 4000, 0, 0, &busy_until, &last_due), now + 4000);
+	KUNIT_EXPECT_EQ(test, wpantap_link_due(now, 4000, 0, 0, &busy_until, &last_due), now + 8000);
+
+	// an idle medium starts at the injection time
+	now += 100000;
+	KUNIT_EXPECT_EQ(test, wpantap_link_due(now, 4000, 2000, 0, &busy_until, &last_due), now + 6000);
+	KUNIT_EXPECT_EQ(test, busy_until, now + 4000);
+
+	// a smaller jitter than the previous frame's waits for it
+	prev = last_due;
+	for(i = 0; i < ARRAY_SIZE(jitter); ++i){
+		due = wpantap_link_due(now, 0, 2000, jitter[i], &busy_until, &last_due);
+		KUNIT_EXPECT_GE(test, due, prev);
+		KUNIT_EXPECT_GE(test, due, now + 2000 + (ktime_t)jitter[i]);
+		prev = due;
+	}
+	KUNIT_EXPECT_EQ(test, last_due, prev);
+}
+
+
+// ringbuf_insert_data2 on a full ring: every insert evicts the oldest frame,
+// as in fakelb_hw_xmit when nobody reads
+static void wpantap_kunit_perf_ring_insert(struct kunit *test)
+{
+	struct ringbuf_t rb;
+	u8 frame[KUNIT_FRAME_LEN];
+	u64 tstamp, start;
+	int i;
+
+	KUNIT_ASSERT_EQ(test, ringbuf_init(&rb, RINGBUF_SIZE), 0);
+	wpantap_kunit_fill(frame, sizeof(frame), 0);
+
+	start = ktime_get_ns();
+	for(i = 0; i < KUNIT_FRAMES; ++i){
+		tstamp = start + i;
+		ringbuf_insert_data2(&rb, sizeof(tstamp), &tstamp, sizeof(frame), frame);
+	}
+	KUNIT_EXPECT_GE(test, wpantap_kunit_fps(test, "ring_insert", KUNIT_FRAMES, ktime_get_ns() - start),
+			(u64)min_enqueue_fps);
+
+	ringbuf_deinit(&rb);
+}
+
+
+// ringbuf_copy_first_data and ringbuf_pop_data, refilling outside the clock
+static void wpantap_kunit_perf_ring_pop(struct kunit *test)
+{
+	struct ringbuf_t rb;
+	u8 frame[KUNIT_FRAME_LEN], out[sizeof(u64) + KUNIT_FRAME_LEN];
+	u64 tstamp = 0, start, total = 0;
+	int frames = 0;
+
+	KUNIT_ASSERT_EQ(test, ringbuf_init(&rb, RINGBUF_SIZE), 0);
+	wpantap_kunit_fill(frame, sizeof(frame), 0);
+
+	while(frames < KUNIT_FRAMES){
+		while(ringbuf_bytes_free(&rb) >= (int)(sizeof(int) + sizeof(out))){
+			ringbuf_insert_data2(&rb, sizeof(tstamp), &tstamp, sizeof(frame), frame);
+		}
+
+		start = ktime_get_ns();
+		while(ringbuf_is_empty(&rb) == 0){
+			ringbuf_copy_first_data(&rb, out);
+			ringbuf_pop_data(&rb);
+			frames++;
+		}
+		total += ktime_get_ns() - start;
+	}
+	KUNIT_EXPECT_GE(test, wpantap_kunit_fps(test, "ring_pop", frames, total), (u64)min_dequeue_fps);
+
+	ringbuf_deinit(&rb);
+}
+
+
+// wpantap_rx_skb_from_iter, the skb construction of a write
+static void wpantap_kunit_perf_skb_from_iter(struct kunit *test)
+{
+	u8 frame[KUNIT_FRAME_LEN];
+	struct kvec kv = { .iov_base = frame, .iov_len = sizeof(frame) };
+	struct iov_iter iter;
+	struct sk_buff *skb;
+	u64 start;
+	int i;
+
+	wpantap_kunit_fill(frame, sizeof(frame), 0);
+
+	start = ktime_get_ns();
+	for(i = 0; i < KUNIT_FRAMES; ++i){
+		iov_iter_kvec(&iter, WRITE, &kv, 1, sizeof(frame));
+		skb = wpantap_rx_skb_from_iter(&iter, sizeof(frame));
+		KUNIT_ASSERT_NOT_ERR_OR_NULL(test, skb);
+		kfree_skb(skb);
+	}
+	KUNIT_EXPECT_GE(test, wpantap_kunit_fps(test, "skb_from_iter", KUNIT_FRAMES, ktime_get_ns() - start),
+			(u64)min_write_skb_fps);
+}
+
+
+static struct kunit_case wpantap_kunit_cases[] = {
+	KUNIT_CASE(wpantap_kunit_ring_roundtrip),
+	KUNIT_CASE(wpantap_kunit_ring_wraparound),
+	KUNIT_CASE(wpantap_kunit_ring_evict),
+	KUNIT_CASE(wpantap_kunit_ring_max_frame),
+	KUNIT_CASE(wpantap_kunit_skb_fcs),
+	KUNIT_CASE(wpantap_kunit_skb_from_iter),
+	KUNIT_CASE(wpantap_kunit_meta_rec_check),
+	KUNIT_CASE(wpantap_kunit_link_due),
+	KUNIT_CASE(wpantap_kunit_perf_ring_insert),
+	KUNIT_CASE(wpantap_kunit_perf_ring_pop),
+	KUNIT_CASE(wpantap_kunit_perf_skb_from_iter),
+	{}
+};
+
+static struct kunit_suite wpantap_kunit_suite = {
+	.name = "wpantap",
+	.test_cases = wpantap_kunit_cases,
+};
+
+kunit_test_suite(wpantap_kunit_suite);
+
+MODULE_LICENSE("GPL");
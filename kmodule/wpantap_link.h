@@ -0,0 +1,35 @@
+/*
+ * Due time of the frames on an emulated link
+ *
+ * Shared by the driver and its KUnit suite.
+ */
+
+#ifndef WPANTAP_LINK_H
+#define WPANTAP_LINK_H
+
+#include <linux/ktime.h>
+
+
+// returns when a frame injected at now is delivered, given its airtime,
+// the delay and the jitter drawn for it; busy_until and last_due carry
+// the state of the link from one frame to the next
+static inline ktime_t wpantap_link_due(ktime_t now, u64 airtime_ns, u64 delay_ns, u64 jitter_ns,
+				       ktime_t *busy_until, ktime_t *last_due)
+{
+	ktime_t due;
+
+	// a frame goes on air once the previous one is done
+	due = ktime_after(*busy_until, now) ? *busy_until : now;
+	due = ktime_add_ns(due, airtime_ns);
+	*busy_until = due;
+
+	due = ktime_add_ns(due, delay_ns + jitter_ns);
+	// jitter never reorders frames
+	if(ktime_before(due, *last_due)){
+		due = *last_due;
+	}
+	*last_due = due;
+	return due;
+}
+
+#endif /* WPANTAP_LINK_H */
@@ -0,0 +1,84 @@
+/*
+ * skb construction of the injection paths (write, metadata write, replay)
+ * and the record check of the metadata write
+ *
+ * Shared by the driver and its KUnit suite.
+ */
+
+#ifndef WPANTAP_SKB_H
+#define WPANTAP_SKB_H
+
+#include <linux/skbuff.h>
+#include <linux/uio.h>
+#include <linux/err.h>
+
+#include "wpantap.h"
+
+// frames handed to the driver carry no FCS, the driver appends a zero one
+#define WPANTAP_FCS_LEN 2
+
+
+// returns an skb of len bytes of frame followed by a zero FCS,
+// the frame bytes are left for the caller to fill in
+static inline struct sk_buff *wpantap_rx_skb_alloc(unsigned int len)
+{
+	struct sk_buff *skb = dev_alloc_skb(len + WPANTAP_FCS_LEN);
+
+	if(skb == NULL){
+		return NULL;
+	}
+
+	skb_put(skb, len);
+	memset(skb_put(skb, WPANTAP_FCS_LEN), 0, WPANTAP_FCS_LEN);
+	return skb;
+}
+
+
+static inline struct sk_buff *wpantap_rx_skb_copy(const void *data, unsigned int len)
+{
+	struct sk_buff *skb = wpantap_rx_skb_alloc(len);
+
+	if(skb != NULL){
+		memcpy(skb->data, data, len);
+	}
+	return skb;
+}
+
+
+// builds the skb of a frame of len bytes taken from the iterator
+// returns an ERR_PTR on failure
+static inline struct sk_buff *wpantap_rx_skb_from_iter(struct iov_iter *from, size_t len)
+{
+	struct sk_buff *skb;
+
+	if(len == 0 || len + WPANTAP_FCS_LEN > WPANTAP_FRAME_MAX){
+		return ERR_PTR(-EINVAL);
+	}
+
+	skb = wpantap_rx_skb_alloc(len);
+	if(skb == NULL){
+		return ERR_PTR(-ENOMEM);
+	}
+
+	if(copy_from_iter(skb->data, len, from) != len){
+		kfree_skb(skb);
+		return ERR_PTR(-EFAULT);
+	}
+	return skb;
+}
+
+
+// checks a metadata record whose header is followed by rest bytes,
+// returns the size of the record or -EINVAL
+static inline ssize_t wpantap_meta_rec_check(const struct wpantap_meta *meta, size_t rest)
+{
+	size_t rec_size = WPANTAP_META_REC_SIZE(meta->len);
+
+	if(meta->len == 0 || meta->len + WPANTAP_FCS_LEN > WPANTAP_FRAME_MAX ||
+	   rec_size - sizeof(*meta) > rest){
+		return -EINVAL;
+	}
+	return rec_size;
+}
+
+#endif /* WPANTAP_SKB_H */
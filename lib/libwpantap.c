@@ -0,0 +1,241 @@
+/* see libwpantap.h */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+
+#include "libwpantap.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+// a frame takes a header, its data and the padding
+#define IOV_PER_FRAME 3
+#define SEND_CHUNK (IOV_MAX / IOV_PER_FRAME)
+
+
+int wpantap_open(struct wpantap_handle *h, int flags, void *arena, size_t arena_size)
+{
+	unsigned int format = WPANTAP_FMT_META;
+	int oflags = O_RDWR;
+	int err;
+
+	memset(h, 0, sizeof(*h));
+	h->fd = -1;
+
+	if (arena_size == 0){
+		arena_size = WPANTAP_LIB_ARENA_DEFAULT;
+	}
+	if (arena_size < WPANTAP_META_REC_SIZE(WPANTAP_FRAME_MAX)){
+		errno = EINVAL;
+		return -1;
+	}
+	if (arena == NULL){
+		arena = malloc(arena_size);
+		if (arena == NULL){
+			return -1;
+		}
+		h->own_arena = 1;
+	}
+	h->arena = arena;
+	h->arena_size = arena_size;
+
+	if (flags & WPANTAP_OPEN_NONBLOCK){
+		oflags |= O_NONBLOCK;
+	}
+	h->fd = open(WPANTAP_DEV_PATH, oflags);
+	if (h->fd < 0){
+		goto err;
+	}
+	if (ioctl(h->fd, WPANTAPSETFORMAT, &format) < 0){
+		goto err;
+	}
+	if (flags & WPANTAP_OPEN_MIRROR){
+		unsigned int depth = 0;
+
+		if (ioctl(h->fd, WPANTAPATTACHMIRROR, &depth) < 0){
+			goto err;
+		}
+	}
+	return 0;
+
+err:
+	err = errno;
+	wpantap_close(h);
+	errno = err;
+	return -1;
+}
+
+
+void wpantap_close(struct wpantap_handle *h)
+{
+	if (h->fd >= 0){
+		close(h->fd);
+	}
+	if (h->own_arena){
+		free(h->arena);
+	}
+	memset(h, 0, sizeof(*h));
+	h->fd = -1;
+}
+
+
+int wpantap_meta_parse(void *buf, size_t len, struct wpantap_frame_ref *frames, int max)
+{
+	uint8_t *p = buf;
+	size_t pos = 0;
+	int n = 0;
+
+	while (pos < len && n < max){
+		struct wpantap_meta meta;
+		size_t rec_size;
+
+		if (len - pos < sizeof(meta)){
+			errno = EINVAL;
+			return -1;
+		}
+		memcpy(&meta, p + pos, sizeof(meta));
+		rec_size = WPANTAP_META_REC_SIZE(meta.len);
+		if (meta.len == 0 || meta.len > WPANTAP_FRAME_MAX || rec_size > len - pos){
+			errno = EINVAL;
+			return -1;
+		}
+
+		frames[n].data = p + pos + sizeof(meta);
+		frames[n].len = meta.len;
+		frames[n].flags = meta.flags;
+		frames[n].tstamp_ns = meta.tstamp_ns;
+		n++;
+		pos += rec_size;
+	}
+
+	return n;
+}
+
+
+int wpantap_recv_batch(struct wpantap_handle *h, struct wpantap_frame_ref *frames, int max)
+{
+	size_t size = h->arena_size;
+	ssize_t bytes;
+
+	// never read more records than there are frames to describe them,
+	// the driver keeps the rest for the next read
+	if (max <= 0){
+		errno = EINVAL;
+		return -1;
+	}
+	if ((size_t)max * WPANTAP_META_REC_SIZE(WPANTAP_FRAME_MAX) < size){
+		size = (size_t)max * WPANTAP_META_REC_SIZE(WPANTAP_FRAME_MAX);
+	}
+
+	bytes = read(h->fd, h->arena, size);
+	if (bytes < 0){
+		return -1;
+	}
+	return wpantap_meta_parse(h->arena, bytes, frames, max);
+}
+
+
+int wpantap_send_batch(struct wpantap_handle *h, const struct wpantap_frame_ref *frames, int n)
+{
+	static const uint8_t pad[WPANTAP_META_ALIGN];
+	struct wpantap_meta meta[SEND_CHUNK];
+	struct iovec iov[SEND_CHUNK * IOV_PER_FRAME];
+	int sent = 0;
+
+	while (sent < n){
+		int count = n - sent < SEND_CHUNK ? n - sent : SEND_CHUNK;
+		int niov = 0;
+		size_t total = 0;
+		ssize_t ret;
+
+		for (int i = 0; i < count; ++i){
+			const struct wpantap_frame_ref *f = &frames[sent + i];
+			size_t padding;
+
+			if (f->len == 0 || f->len + WPANTAP_LIB_FCS_LEN > WPANTAP_FRAME_MAX){
+				errno = EINVAL;
+				return sent > 0 ? sent : -1;
+			}
+
+			meta[i].tstamp_ns = f->tstamp_ns;
+			meta[i].len = f->len;
+			meta[i].flags = 0;
+			padding = WPANTAP_META_REC_SIZE(f->len) - sizeof(meta[i]) - f->len;
+
+			iov[niov].iov_base = &meta[i];
+			iov[niov++].iov_len = sizeof(meta[i]);
+			iov[niov].iov_base = f->data;
+			iov[niov++].iov_len = f->len;
+			if (padding > 0){
+				iov[niov].iov_base = (void *)pad;
+				iov[niov++].iov_len = padding;
+			}
+			total += WPANTAP_META_REC_SIZE(f->len);
+		}
+
+		ret = writev(h->fd, iov, niov);
+		if (ret < 0){
+			return sent > 0 ? sent : -1;
+		}
+		// the driver consumes whole records
+		if ((size_t)ret < total){
+			size_t done = 0;
+
+			for (int i = 0; i < count && done + WPANTAP_META_REC_SIZE(meta[i].len) <= (size_t)ret; ++i){
+				done += WPANTAP_META_REC_SIZE(meta[i].len);
+				sent++;
+			}
+			return sent;
+		}
+		sent += count;
+	}
+
+	return sent;
+}
+
+
+uint16_t wpantap_fcs(const void *data, size_t len)
+{
+	const uint8_t *p = data;
+	uint16_t crc = 0;
+
+	// reflected polynomial 0x1021, bit by bit, a frame is short
+	while (len--){
+		crc ^= *p++;
+		for (int i = 0; i < 8; ++i){
+			crc = (crc & 1) ? (crc >> 1) ^ 0x8408 : crc >> 1;
+		}
+	}
+	return crc;
+}
+
+
+size_t wpantap_fcs_append(void *frame, size_t len)
+{
+	uint8_t *p = frame;
+	uint16_t fcs = wpantap_fcs(frame, len);
+
+	// sent least significant byte first
+	p[len] = fcs & 0xff;
+	p[len + 1] = fcs >> 8;
+	return len + WPANTAP_LIB_FCS_LEN;
+}
+
+
+int wpantap_fcs_check(const void *frame, size_t len_with_fcs)
+{
+	const uint8_t *p = frame;
+	uint16_t fcs;
+
+	if (len_with_fcs < WPANTAP_LIB_FCS_LEN){
+		return 0;
+	}
+	fcs = wpantap_fcs(frame, len_with_fcs - WPANTAP_LIB_FCS_LEN);
+	return p[len_with_fcs - 2] == (fcs & 0xff) && p[len_with_fcs - 1] == (fcs >> 8);
+}
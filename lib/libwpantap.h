@@ -0,0 +1,84 @@
+/*
+ * libwpantap: user-space access to /dev/net/wpantap
+ *
+ * Opens the device in the WPANTAP_FMT_META format and moves frames in
+ * batches: one read() returns every frame that fits in the receive arena
+ * of the handle, one writev() injects a whole vector of frames. Received
+ * frames are not copied, they point into the arena and stay valid until
+ * the next receive on the same handle. Sent frames are gathered straight
+ * from the caller's buffers.
+ *
+ * Functions returning int return -1 and set errno on failure, like the
+ * system calls they wrap.
+ */
+
+#ifndef LIBWPANTAP_H
+#define LIBWPANTAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../kmodule/wpantap.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define WPANTAP_LIB_FCS_LEN 2
+// receive arena of a handle, in bytes, when none is given
+#define WPANTAP_LIB_ARENA_DEFAULT (64 * 1024)
+
+// wpantap_open flags
+#define WPANTAP_OPEN_NONBLOCK 0x1	// receive returns -1/EAGAIN instead of waiting
+#define WPANTAP_OPEN_MIRROR   0x2	// read-only mirror, see WPANTAPATTACHMIRROR
+
+// a frame in a batch, data is not owned by the frame
+struct wpantap_frame_ref {
+	uint8_t *data;
+	uint32_t len;		// received: with FCS, sent: without FCS
+	uint32_t flags;
+	uint64_t tstamp_ns;	// received: capture time, sent: delivery time in virtual time mode
+};
+
+struct wpantap_handle {
+	int fd;
+
+	// receive arena, frames received last point into it
+	uint8_t *arena;
+	size_t arena_size;
+	int own_arena;
+};
+
+/*
+ * Opens the device. arena receives the frames (arena_size bytes, at least
+ * one record of the longest frame); with a NULL arena the handle allocates
+ * arena_size bytes, or WPANTAP_LIB_ARENA_DEFAULT if arena_size is 0.
+ */
+int wpantap_open(struct wpantap_handle *h, int flags, void *arena, size_t arena_size);
+void wpantap_close(struct wpantap_handle *h);
+
+// receives up to max frames with one read(), returns the number of frames
+int wpantap_recv_batch(struct wpantap_handle *h, struct wpantap_frame_ref *frames, int max);
+
+// sends n frames (without FCS) with as few writev() as possible,
+// returns the number of frames sent
+int wpantap_send_batch(struct wpantap_handle *h, const struct wpantap_frame_ref *frames, int n);
+
+/*
+ * Splits len bytes of WPANTAP_FMT_META records into frames, returns the
+ * number of frames, or -1/EINVAL if a record is malformed.
+ */
+int wpantap_meta_parse(void *buf, size_t len, struct wpantap_frame_ref *frames, int max);
+
+// FCS of IEEE 802.15.4 (ITU-T CRC-16, as crc_ccitt in the kernel)
+uint16_t wpantap_fcs(const void *data, size_t len);
+// writes the FCS of the len bytes of frame after them, returns len + 2
+size_t wpantap_fcs_append(void *frame, size_t len);
+// returns 1 if the last two bytes of frame are its FCS
+int wpantap_fcs_check(const void *frame, size_t len_with_fcs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBWPANTAP_H */
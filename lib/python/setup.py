@@ -0,0 +1,13 @@
+# python3 setup.py build_ext --inplace
+
+from setuptools import setup, Extension
+
+setup(
+    name='wpantap',
+    version='0.1',
+    description='Batched, zero-copy frame I/O on /dev/net/wpantap',
+    ext_modules=[
+        Extension('wpantap', sources=['wpantapmodule.c', '../libwpantap.c'],
+                  extra_compile_args=['-O2']),
+    ],
+)
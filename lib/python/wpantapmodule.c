@@ -0,0 +1,391 @@
+/*
+ * Python binding of libwpantap
+ *
+ *   import wpantap
+ *   dev = wpantap.Device()
+ *   for frame, tstamp_ns in dev.recv():   # memoryviews into dev.arena
+ *       sock.sendto(frame, peer)
+ *   dev.send([buf[:-2] for buf in datagrams])
+ *
+ * The receive arena is a bytearray allocated once per device. recv() hands
+ * out memoryview slices of it, so no bytes object is created per frame;
+ * the slices are overwritten by the next recv(), copy what must be kept.
+ * Concurrent recv() calls on one device take turns, but a thread still sees
+ * its views overwritten by the next recv() of any thread.
+ * send() takes any objects supporting the buffer protocol and gathers them
+ * into one writev() without copying.
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <pythread.h>
+
+#include "../libwpantap.h"
+
+#define BATCH_MAX 1024
+
+typedef struct {
+	PyObject_HEAD
+	struct wpantap_handle h;
+	// bytearray backing h.arena, and a memoryview of it to slice
+	PyObject *arena;
+	PyObject *view;
+	int batch;
+	// recv() runs without the GIL, the lock keeps a second recv() off the
+	// frames and the arena until the views are built
+	PyThread_type_lock recv_lock;
+	struct wpantap_frame_ref recv_frames[BATCH_MAX];
+} DeviceObject;
+
+
+static int Device_init(DeviceObject *self, PyObject *args, PyObject *kwds)
+{
+	static char *kwlist[] = {"nonblock", "mirror", "batch", "arena_size", NULL};
+	int nonblock = 0, mirror = 0, flags = 0;
+	Py_ssize_t arena_size = WPANTAP_LIB_ARENA_DEFAULT;
+
+	if (self->arena != NULL){
+		PyErr_SetString(PyExc_RuntimeError, "device is already initialised");
+		return -1;
+	}
+
+	self->batch = 64;
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|ppin", kwlist,
+					 &nonblock, &mirror, &self->batch, &arena_size)){
+		return -1;
+	}
+	if (self->batch < 1 || self->batch > BATCH_MAX){
+		PyErr_Format(PyExc_ValueError, "batch must be between 1 and %d", BATCH_MAX);
+		return -1;
+	}
+	if (arena_size < (Py_ssize_t)WPANTAP_META_REC_SIZE(WPANTAP_FRAME_MAX)){
+		PyErr_SetString(PyExc_ValueError, "arena_size cannot hold the longest frame");
+		return -1;
+	}
+
+	if (self->recv_lock == NULL){
+		self->recv_lock = PyThread_allocate_lock();
+		if (self->recv_lock == NULL){
+			PyErr_NoMemory();
+			return -1;
+		}
+	}
+
+	self->arena = PyByteArray_FromStringAndSize(NULL, arena_size);
+	if (self->arena == NULL){
+		return -1;
+	}
+	self->view = PyMemoryView_FromObject(self->arena);
+	if (self->view == NULL){
+		Py_CLEAR(self->arena);
+		return -1;
+	}
+
+	if (nonblock){
+		flags |= WPANTAP_OPEN_NONBLOCK;
+	}
+	if (mirror){
+		flags |= WPANTAP_OPEN_MIRROR;
+	}
+	if (wpantap_open(&self->h, flags, PyByteArray_AS_STRING(self->arena), arena_size) < 0){
+		PyErr_SetFromErrnoWithFilename(PyExc_OSError, WPANTAP_DEV_PATH);
+		// a later __init__ may try again
+		Py_CLEAR(self->view);
+		Py_CLEAR(self->arena);
+		return -1;
+	}
+	return 0;
+}
+
+
+static void Device_dealloc(DeviceObject *self)
+{
+	// the handle is zeroed until wpantap_open succeeds
+	if (self->h.arena != NULL){
+		wpantap_close(&self->h);
+	}
+	if (self->recv_lock != NULL){
+		PyThread_free_lock(self->recv_lock);
+	}
+	Py_XDECREF(self->view);
+	Py_XDECREF(self->arena);
+	Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+
+static PyObject *Device_recv(DeviceObject *self, PyObject *Py_UNUSED(ignored))
+{
+	PyObject *list = NULL, *slice, *frame, *item;
+	uint8_t *base;
+	int n;
+
+	if (self->arena == NULL || self->h.fd < 0){
+		PyErr_SetString(PyExc_ValueError, "device is closed");
+		return NULL;
+	}
+	base = (uint8_t *)PyByteArray_AS_STRING(self->arena);
+
+	// wait for the lock without the GIL, its holder needs the GIL to finish
+	Py_BEGIN_ALLOW_THREADS
+	PyThread_acquire_lock(self->recv_lock, WAIT_LOCK);
+	n = wpantap_recv_batch(&self->h, self->recv_frames, self->batch);
+	Py_END_ALLOW_THREADS
+	if (n < 0){
+		if (errno == EAGAIN){
+			list = PyList_New(0);
+		}else{
+			PyErr_SetFromErrno(PyExc_OSError);
+		}
+		goto out;
+	}
+
+	list = PyList_New(n);
+	if (list == NULL){
+		goto out;
+	}
+	for (int i = 0; i < n; ++i){
+		Py_ssize_t start = self->recv_frames[i].data - base;
+		PyObject *lo = PyLong_FromSsize_t(start);
+		PyObject *hi = PyLong_FromSsize_t(start + self->recv_frames[i].len);
+
+		slice = (lo && hi) ? PySlice_New(lo, hi, NULL) : NULL;
+		Py_XDECREF(lo);
+		Py_XDECREF(hi);
+		if (slice == NULL){
+			Py_CLEAR(list);
+			goto out;
+		}
+		frame = PyObject_GetItem(self->view, slice);
+		Py_DECREF(slice);
+		if (frame == NULL){
+			Py_CLEAR(list);
+			goto out;
+		}
+		item = Py_BuildValue("(NK)", frame, (unsigned long long)self->recv_frames[i].tstamp_ns);
+		if (item == NULL){
+			Py_CLEAR(list);
+			goto out;
+		}
+		PyList_SET_ITEM(list, i, item);
+	}
+
+out:
+	PyThread_release_lock(self->recv_lock);
+	return list;
+}
+
+
+static PyObject *Device_send(DeviceObject *self, PyObject *args, PyObject *kwds)
+{
+	static char *kwlist[] = {"frames", "strip_fcs", NULL};
+	// on the heap, a batch of them is too large for a small thread stack
+	Py_buffer *bufs = NULL;
+	struct wpantap_frame_ref *send_frames = NULL;
+	PyObject *seq, *frames, *result = NULL;
+	Py_ssize_t n, max;
+	int strip_fcs = 0;
+	int sent = 0, ret;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|p", kwlist, &frames, &strip_fcs)){
+		return NULL;
+	}
+	if (self->arena == NULL || self->h.fd < 0){
+		PyErr_SetString(PyExc_ValueError, "device is closed");
+		return NULL;
+	}
+	seq = PySequence_Fast(frames, "frames must be a sequence of buffers");
+	if (seq == NULL){
+		return NULL;
+	}
+
+	n = PySequence_Fast_GET_SIZE(seq);
+	max = n < BATCH_MAX ? n : BATCH_MAX;
+	bufs = PyMem_New(Py_buffer, max ? max : 1);
+	send_frames = PyMem_New(struct wpantap_frame_ref, max ? max : 1);
+	if (bufs == NULL || send_frames == NULL){
+		PyErr_NoMemory();
+		goto out;
+	}
+
+	for (Py_ssize_t done = 0; done < n; done += BATCH_MAX){
+		int count = n - done < BATCH_MAX ? (int)(n - done) : BATCH_MAX;
+		int held = 0;
+
+		for (; held < count; ++held){
+			PyObject *obj = PySequence_Fast_GET_ITEM(seq, done + held);
+
+			if (PyObject_GetBuffer(obj, &bufs[held], PyBUF_SIMPLE) < 0){
+				break;
+			}
+			send_frames[held].data = bufs[held].buf;
+			send_frames[held].len = bufs[held].len;
+			if (strip_fcs){
+				send_frames[held].len = bufs[held].len > WPANTAP_LIB_FCS_LEN ? bufs[held].len - WPANTAP_LIB_FCS_LEN : 0;
+			}
+			send_frames[held].flags = 0;
+			send_frames[held].tstamp_ns = 0;
+		}
+
+		ret = -1;
+		if (held == count){
+			Py_BEGIN_ALLOW_THREADS
+			ret = wpantap_send_batch(&self->h, send_frames, count);
+			Py_END_ALLOW_THREADS
+		}
+		for (int i = 0; i < held; ++i){
+			PyBuffer_Release(&bufs[i]);
+		}
+
+		if (held < count){
+			goto out;
+		}
+		if (ret < 0){
+			if (errno == EAGAIN && sent > 0){
+				break;
+			}
+			PyErr_SetFromErrno(PyExc_OSError);
+			goto out;
+		}
+		sent += ret;
+		if (ret < count){
+			break;
+		}
+	}
+	result = PyLong_FromLong(sent);
+
+out:
+	PyMem_Free(send_frames);
+	PyMem_Free(bufs);
+	Py_DECREF(seq);
+	return result;
+}
+
+
+static PyObject *Device_fileno(DeviceObject *self, PyObject *Py_UNUSED(ignored))
+{
+	return PyLong_FromLong(self->h.fd);
+}
+
+
+static PyObject *Device_close(DeviceObject *self, PyObject *Py_UNUSED(ignored))
+{
+	if (self->h.fd >= 0){
+		close(self->h.fd);
+		self->h.fd = -1;
+	}
+	Py_RETURN_NONE;
+}
+
+
+static PyObject *Device_get_arena(DeviceObject *self, void *closure)
+{
+	(void)closure;
+	Py_INCREF(self->view);
+	return self->view;
+}
+
+
+static PyMethodDef Device_methods[] = {
+	{"recv", (PyCFunction)Device_recv, METH_NOARGS,
+	 "recv() -> [(memoryview, tstamp_ns), ...]\n\n"
+	 "Receives a batch of frames (with FCS) with one read(). The views point\n"
+	 "into the arena and are overwritten by the next recv(), from any thread.\n"
+	 "Returns an empty list when a non-blocking device has no frame."},
+	{"send", (PyCFunction)(void (*)(void))Device_send, METH_VARARGS | METH_KEYWORDS,
+	 "send(frames, strip_fcs=False) -> int\n\n"
+	 "Sends a sequence of buffers, each one a frame without FCS (or with it\n"
+	 "and strip_fcs=True), with as few writev() as possible. Returns the\n"
+	 "number of frames sent."},
+	{"fileno", (PyCFunction)Device_fileno, METH_NOARGS, "fileno() -> int, for select and selectors"},
+	{"close", (PyCFunction)Device_close, METH_NOARGS, "close()"},
+	{NULL}
+};
+
+static PyGetSetDef Device_getset[] = {
+	{"arena", (getter)Device_get_arena, NULL, "memoryview of the receive arena", NULL},
+	{NULL}
+};
+
+static PyTypeObject DeviceType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	.tp_name = "wpantap.Device",
+	.tp_doc = "Device(nonblock=False, mirror=False, batch=64, arena_size=65536)\n\n"
+		  "A handle of /dev/net/wpantap in the metadata format.",
+	.tp_basicsize = sizeof(DeviceObject),
+	.tp_flags = Py_TPFLAGS_DEFAULT,
+	.tp_new = PyType_GenericNew,
+	.tp_init = (initproc)Device_init,
+	.tp_dealloc = (destructor)Device_dealloc,
+	.tp_methods = Device_methods,
+	.tp_getset = Device_getset,
+};
+
+
+static PyObject *wpantap_py_fcs(PyObject *module, PyObject *arg)
+{
+	Py_buffer buf;
+	uint16_t fcs;
+
+	(void)module;
+	if (PyObject_GetBuffer(arg, &buf, PyBUF_SIMPLE) < 0){
+		return NULL;
+	}
+	fcs = wpantap_fcs(buf.buf, buf.len);
+	PyBuffer_Release(&buf);
+	return PyLong_FromLong(fcs);
+}
+
+
+static PyObject *wpantap_py_fcs_check(PyObject *module, PyObject *arg)
+{
+	Py_buffer buf;
+	int ok;
+
+	(void)module;
+	if (PyObject_GetBuffer(arg, &buf, PyBUF_SIMPLE) < 0){
+		return NULL;
+	}
+	ok = wpantap_fcs_check(buf.buf, buf.len);
+	PyBuffer_Release(&buf);
+	return PyBool_FromLong(ok);
+}
+
+
+static PyMethodDef module_methods[] = {
+	{"fcs", wpantap_py_fcs, METH_O, "fcs(frame) -> int, the FCS of the frame bytes"},
+	{"fcs_check", wpantap_py_fcs_check, METH_O, "fcs_check(frame) -> bool, True if the frame ends with its FCS"},
+	{NULL}
+};
+
+static struct PyModuleDef wpantap_module = {
+	PyModuleDef_HEAD_INIT,
+	.m_name = "wpantap",
+	.m_doc = "Batched, zero-copy frame I/O on /dev/net/wpantap.",
+	.m_size = -1,
+	.m_methods = module_methods,
+};
+
+
+PyMODINIT_FUNC PyInit_wpantap(void)
+{
+	PyObject *m;
+
+	if (PyType_Ready(&DeviceType) < 0){
+		return NULL;
+	}
+
+	m = PyModule_Create(&wpantap_module);
+	if (m == NULL){
+		return NULL;
+	}
+
+	Py_INCREF(&DeviceType);
+	if (PyModule_AddObject(m, "Device", (PyObject *)&DeviceType) < 0){
+		Py_DECREF(&DeviceType);
+		Py_DECREF(m);
+		return NULL;
+	}
+	PyModule_AddIntConstant(m, "FCS_LEN", WPANTAP_LIB_FCS_LEN);
+	PyModule_AddIntConstant(m, "FRAME_MAX", WPANTAP_FRAME_MAX);
+	return m;
+}
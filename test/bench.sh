@@ -0,0 +1,50 @@
+#!/bin/bash
+
+# Packet-rate and latency benchmark of both data paths of the driver.
+#
+#   tx: AF_PACKET on wpan0 -> fakelb_hw_xmit -> read() on /dev/net/wpantap
+#   rx: write() on /dev/net/wpantap -> rx path -> AF_PACKET on wpan0
+#
+# usage: sudo ./bench.sh [label] [count] > results.csv
+# Compare the CSV of a driver change against the one of the baseline.
+
+label=${1:-wpantap}
+count=${2:-100000}
+sizes="41 64 96 125"
+rates="0 1000 10000"
+
+cd "$(dirname "$0")"
+
+for prog in bench_gen bench_sink; do
+	if [ ! -x $prog ]; then
+		gcc -O2 -pthread $prog.c -o $prog || exit 1
+	fi
+done
+
+ip link set wpan0 up
+
+echo "direction,$(./bench_sink -H)"
+
+for size in $sizes; do
+	for rate in $rates; do
+		for direction in tx rx; do
+			if [ $direction = tx ]; then
+				gen_mode=packet
+				sink_mode=dev
+			else
+				gen_mode=dev
+				sink_mode=packet
+			fi
+
+			./bench_sink -m $sink_mode -n $count -t 60 -l "$label-$size-$rate" > sink.out &
+			sink=$!
+			sleep 0.5
+			./bench_gen -m $gen_mode -s $size -r $rate -n $count > /dev/null
+			wait $sink
+
+			echo "$direction,$(cat sink.out)"
+		done
+	done
+done
+
+rm -f sink.out
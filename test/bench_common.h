@@ -0,0 +1,121 @@
+/*
+ * Shared framing of the benchmark programs (bench_gen, bench_sink).
+ *
+ * A benchmark frame is the frame of test_write (sent to the broadcast
+ * address so that wpan0 accepts it) followed by a struct bench_payload
+ * and filler bytes up to the requested size.
+ */
+
+#ifndef BENCH_COMMON_H
+#define BENCH_COMMON_H
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <linux/if_packet.h>
+#include <arpa/inet.h>
+
+#ifndef ETH_P_IEEE802154
+#define ETH_P_IEEE802154 0x00F6
+#endif
+
+#define BENCH_MAGIC 0x57504254 /* "WPBT" */
+#define BENCH_HDR_LEN 17
+/* longest frame without the 2 byte FCS */
+#define BENCH_MAX_FRAME 125
+
+struct bench_payload {
+	uint32_t magic;
+	uint32_t run;		/* identifies one generator run */
+	uint64_t seq;		/* starts at 0 */
+	uint64_t tx_ns;		/* CLOCK_MONOTONIC when the frame was sent */
+} __attribute__((packed));
+
+#define BENCH_MIN_FRAME (BENCH_HDR_LEN + (int)sizeof(struct bench_payload))
+
+static inline uint64_t bench_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* builds a frame of size bytes (without FCS) into buf */
+static inline void bench_build_frame(uint8_t *buf, int size, uint32_t run, uint64_t seq)
+{
+	struct bench_payload p;
+
+	buf[0] = 0x01; /* Frame Control Field: data frame, no ack request */
+	buf[1] = 0xc8; /* Frame Control Field */
+	buf[2] = (uint8_t)seq; /* Sequence number */
+	buf[3] = 0xff; /* Destination PAN ID 0xffff */
+	buf[4] = 0xff; /* Destination PAN ID */
+	buf[5] = 0xff; /* Destination short address 0xffff */
+	buf[6] = 0xff; /* Destination short address */
+	buf[7] = 0x23; /* Source PAN ID 0x0023 */
+	buf[8] = 0x00; /* */
+	buf[9] = 0x60; /* Source extended address ae:c2:4a:1c:21:16:e2:60 */
+	buf[10] = 0xe2; /* */
+	buf[11] = 0x16; /* */
+	buf[12] = 0x21; /* */
+	buf[13] = 0x1c; /* */
+	buf[14] = 0x4a; /* */
+	buf[15] = 0xc2; /* */
+	buf[16] = 0xae; /* */
+
+	p.magic = BENCH_MAGIC;
+	p.run = run;
+	p.seq = seq;
+	p.tx_ns = bench_now_ns();
+	memcpy(buf + BENCH_HDR_LEN, &p, sizeof(p));
+
+	memset(buf + BENCH_MIN_FRAME, 0xAA, size - BENCH_MIN_FRAME);
+}
+
+/* returns 0 if buf holds a benchmark frame */
+static inline int bench_parse_frame(const uint8_t *buf, int len, struct bench_payload *p)
+{
+	if (len < BENCH_MIN_FRAME){
+		return -1;
+	}
+	memcpy(p, buf + BENCH_HDR_LEN, sizeof(*p));
+	return p->magic == BENCH_MAGIC ? 0 : -1;
+}
+
+/* opens an AF_PACKET socket bound to ifname, like af_packet_tx */
+static inline int bench_open_packet(const char *ifname)
+{
+	struct sockaddr_ll sll;
+	struct ifreq ifr;
+	int sd;
+
+	sd = socket(PF_PACKET, SOCK_RAW, htons(ETH_P_IEEE802154));
+	if (sd < 0){
+		return -1;
+	}
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+	if (ioctl(sd, SIOCGIFINDEX, &ifr) < 0){
+		close(sd);
+		return -1;
+	}
+
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_ifindex = ifr.ifr_ifindex;
+	sll.sll_protocol = htons(ETH_P_IEEE802154);
+	if (bind(sd, (struct sockaddr *)&sll, sizeof(sll)) < 0){
+		close(sd);
+		return -1;
+	}
+
+	return sd;
+}
+
+#endif /* BENCH_COMMON_H */
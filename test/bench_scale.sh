@@ -0,0 +1,120 @@
+#!/bin/bash
+
+# Multi-core scalability benchmark of both data paths of the driver.
+#
+# Sweeps the number of sender threads (each one with its own fd) and the
+# CPU placement of the threads, and records per point the achieved and the
+# delivered rate, the drops, the CPU utilisation and the context switches.
+# wpan0 is moved into its own network namespace like lowpan_setup.sh does,
+# so that nothing else on the host sends through it.
+#
+#   spread: thread i is pinned to CPU i % nproc
+#   single: every thread is pinned to CPU 0
+#
+# The last columns give the speedup and the efficiency against one thread;
+# knee=1 marks the first point where adding threads gains less than 10%,
+# i.e. where the driver locks start to dominate.
+#
+# usage: sudo ./bench_scale.sh [label] [count] [max_threads] > scale.csv
+
+label=${1:-wpantap}
+count=${2:-200000}
+max_threads=${3:-$(nproc)}
+size=41
+netns=wpan0
+
+cd "$(dirname "$0")"
+
+for prog in bench_gen bench_sink; do
+	if [ ! -x $prog ]; then
+		gcc -O2 -pthread $prog.c -o $prog || exit 1
+	fi
+done
+
+PHYNUM=`iwpan dev | grep -B 1 wpan0 | sed -ne '1 s/phy#\([0-9]\)/\1/p'`
+if [ -n "$PHYNUM" ]; then
+	ip netns delete $netns 2> /dev/null
+	ip netns add $netns
+	iwpan phy${PHYNUM} set netns name $netns
+fi
+ip netns exec $netns ip link set wpan0 up
+
+# prints "busy_jiffies total_jiffies context_switches"
+cpu_sample()
+{
+	awk '/^cpu / { for (i = 2; i <= NF; i++) total += $i; busy = total - $5 - $6 }
+		/^ctxt/ { ctxt = $2 }
+		END { print busy, total, ctxt }' /proc/stat
+}
+
+cpu_list()
+{
+	local threads=$1 placement=$2 list="" i
+
+	for ((i = 0; i < threads; i++)); do
+		if [ $placement = spread ]; then
+			list="$list,$((i % $(nproc)))"
+		else
+			list="$list,0"
+		fi
+	done
+	echo ${list#,}
+}
+
+threads_list=1
+for ((t = 2; t <= max_threads; t *= 2)); do
+	threads_list="$threads_list $t"
+done
+
+{
+echo "label,direction,placement,threads,gen_fps,sink_fps,drops,errors,cpu_util,ctxt_per_frame,gen_vcsw,gen_ivcsw"
+
+for direction in tx rx; do
+	if [ $direction = tx ]; then
+		gen="ip netns exec $netns ./bench_gen -m packet"
+		sink="./bench_sink -m dev"
+	else
+		gen="./bench_gen -m dev"
+		sink="ip netns exec $netns ./bench_sink -m packet"
+	fi
+
+	for placement in spread single; do
+		for threads in $threads_list; do
+			$sink -n $count -t 60 -l "$label" > sink.out &
+			sink_pid=$!
+			sleep 0.5
+
+			read busy0 total0 ctxt0 <<< "$(cpu_sample)"
+			$gen -s $size -n $count -T $threads -c $(cpu_list $threads $placement) > gen.out
+			read busy1 total1 ctxt1 <<< "$(cpu_sample)"
+			wait $sink_pid
+
+			# gen: tool,mode,size,target_rate,threads,frames,seconds,fps,errors,vcsw,ivcsw
+			# sink: label,mode,frames,seconds,fps,drops,...
+			IFS=, read -r _ _ _ _ _ _ _ gen_fps errors vcsw ivcsw < gen.out
+			IFS=, read -r _ _ _ _ sink_fps drops _ < sink.out
+
+			awk -v busy=$((busy1 - busy0)) -v total=$((total1 - total0)) \
+				-v ctxt=$((ctxt1 - ctxt0)) -v count=$count \
+				'BEGIN { printf "%.1f,%.3f", total ? 100 * busy / total : 0, ctxt / count }' > cpu.out
+
+			echo "$label,$direction,$placement,$threads,$gen_fps,$sink_fps,$drops,$errors,$(cat cpu.out),$vcsw,$ivcsw"
+		done
+	done
+done
+} | awk -F, -v OFS=, '
+	NR == 1 { print $0, "speedup,efficiency,knee"; next }
+	{
+		key = $2 "," $3
+		if ($4 == 1) { base[key] = $6; prev[key] = $6; found[key] = 0 }
+		speedup = base[key] > 0 ? $6 / base[key] : 0
+		knee = 0
+		if ($4 > 1 && !found[key] && prev[key] > 0 && $6 < 1.1 * prev[key]) {
+			knee = 1
+			found[key] = 1
+		}
+		prev[key] = $6
+		print $0, sprintf("%.2f,%.2f,%d", speedup, speedup / $4, knee)
+	}'
+
+rm -f sink.out gen.out cpu.out
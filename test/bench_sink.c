@@ -0,0 +1,181 @@
+/* gcc -O2 bench_sink.c -o bench_sink */
+
+/*
+ * Benchmark frame sink, counterpart of bench_gen.
+ *
+ *   -m dev      read from /dev/net/wpantap (bench_gen -m packet)
+ *   -m packet   read from AF_PACKET on the interface (bench_gen -m dev)
+ *   -i ifname   interface of packet mode (default wpan0)
+ *   -n count    stop after count frames
+ *   -t seconds  stop after this long (default 10), or after 2 idle seconds
+ *   -l label    first CSV column, e.g. the driver version under test
+ *   -H          print the CSV header
+ *
+ * Drops are derived from the sequence numbers and the one-way latency from
+ * the send timestamps, both embedded by bench_gen. Prints one CSV line:
+ * label,mode,frames,seconds,fps,drops,p50_us,p99_us,p999_us,max_us
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+
+#include "bench_common.h"
+#include "../kmodule/wpantap.h"
+
+/* latency samples kept, later samples replace random earlier ones */
+#define MAX_SAMPLES (4 * 1024 * 1024)
+
+static uint64_t *samples;
+static unsigned long nsamples;
+
+static void add_sample(uint64_t latency, unsigned long index)
+{
+	if (nsamples < MAX_SAMPLES){
+		samples[nsamples++] = latency;
+	}else{
+		unsigned long slot = (unsigned long)random() % (index + 1);
+		if (slot < MAX_SAMPLES){
+			samples[slot] = latency;
+		}
+	}
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double percentile_us(double p)
+{
+	if (nsamples == 0){
+		return 0;
+	}
+	return samples[(unsigned long)(p * (nsamples - 1))] / 1e3;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *mode = "dev";
+	const char *ifname = "wpan0";
+	const char *label = "wpantap";
+	unsigned long count = 0;
+	int duration = 10;
+	unsigned long frames = 0;
+	uint64_t max_seq = 0, first_ns = 0, last_ns = 0, deadline;
+	uint32_t run = 0;
+	uint8_t buf[WPANTAP_FRAME_MAX];
+	struct bench_payload p;
+	struct pollfd pfd;
+	int opt, fd, bytes, ret;
+
+	while ((opt = getopt(argc, argv, "m:i:n:t:l:H")) != -1){
+		switch (opt){
+		case 'm':
+			mode = optarg;
+			break;
+		case 'i':
+			ifname = optarg;
+			break;
+		case 'n':
+			count = strtoul(optarg, NULL, 10);
+			break;
+		case 't':
+			duration = atoi(optarg);
+			break;
+		case 'l':
+			label = optarg;
+			break;
+		case 'H':
+			printf("label,mode,frames,seconds,fps,drops,p50_us,p99_us,p999_us,max_us\n");
+			return 0;
+		default:
+			fprintf(stderr, "usage: %s [-m dev|packet] [-i ifname] [-n count] [-t seconds] [-l label] [-H]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	samples = malloc(MAX_SAMPLES * sizeof(*samples));
+	if (samples == NULL){
+		perror("malloc");
+		return 1;
+	}
+
+	if (strcmp(mode, "packet") == 0){
+		fd = bench_open_packet(ifname);
+	}else{
+		fd = open(WPANTAP_DEV_PATH, O_RDWR);
+	}
+	if (fd < 0){
+		perror("open");
+		return 1;
+	}
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	deadline = bench_now_ns() + (uint64_t)duration * 1000000000ULL;
+
+	while (count == 0 || frames < count){
+		ret = poll(&pfd, 1, frames ? 2000 : 1000);
+		if (ret < 0){
+			perror("poll");
+			break;
+		}
+		if (ret == 0){
+			/* idle after the generator finished */
+			if (frames > 0 || bench_now_ns() > deadline){
+				break;
+			}
+			continue;
+		}
+
+		bytes = read(fd, buf, sizeof(buf));
+		uint64_t now = bench_now_ns();
+		if (bytes < 0){
+			perror("read");
+			break;
+		}
+		if (bench_parse_frame(buf, bytes, &p) != 0){
+			continue;
+		}
+
+		/* the first frame selects the generator run to measure */
+		if (frames == 0){
+			run = p.run;
+			first_ns = now;
+		}else if (p.run != run){
+			continue;
+		}
+
+		if (p.seq > max_seq){
+			max_seq = p.seq;
+		}
+		add_sample(now - p.tx_ns, frames);
+		frames++;
+		last_ns = now;
+
+		if (now > deadline){
+			break;
+		}
+	}
+
+	qsort(samples, nsamples, sizeof(*samples), cmp_u64);
+
+	double seconds = (last_ns - first_ns) / 1e9;
+	unsigned long expected = frames ? max_seq + 1 : 0;
+	printf("%s,%s,%lu,%.6f,%.1f,%lu,%.1f,%.1f,%.1f,%.1f\n",
+		label, mode, frames, seconds, seconds > 0 ? frames / seconds : 0.0,
+		expected > frames ? expected - frames : 0,
+		percentile_us(0.5), percentile_us(0.99), percentile_us(0.999),
+		percentile_us(1.0));
+
+	free(samples);
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,105 @@
+/* gcc fq.c -o fq */
+
+/*
+ * Turns fair queueing on or off and shows its flows.
+ *
+ *   sudo ./fq -e                  per-source fair queueing with the defaults
+ *   sudo ./fq -e -q 512 -d 128    512 bytes per round, 128 frames per flow
+ *   sudo ./fq                     show the flows and their counters
+ *   sudo ./fq -x                  back to the shared FIFO
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+
+#include "../kmodule/wpantap.h"
+
+static struct wpantap_fq_flow_stats flows[WPANTAP_FQ_FLOWS_MAX];
+
+int main(int argc, char *argv[])
+{
+	struct wpantap_fq_cfg cfg;
+	struct wpantap_fq_stats stats;
+	int set = 0;
+	int opt;
+
+	memset(&cfg, 0, sizeof(cfg));
+
+	while ((opt = getopt(argc, argv, "eq:d:x")) != -1){
+		switch (opt){
+		case 'e':
+			cfg.enabled = 1;
+			set = 1;
+			break;
+		case 'q':
+			cfg.quantum = atoi(optarg);
+			break;
+		case 'd':
+			cfg.depth = atoi(optarg);
+			break;
+		case 'x':
+			cfg.enabled = 0;
+			set = 1;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-e [-q quantum] [-d depth] | -x]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	int fd = open(WPANTAP_DEV_PATH, O_RDWR);
+	if (fd < 0){
+		perror("open");
+		printf("unable to open wpantap device\n");
+		return 1;
+	}
+
+	if (set && ioctl(fd, WPANTAPSETFQ, &cfg) < 0){
+		perror("WPANTAPSETFQ");
+		close(fd);
+		return 1;
+	}
+
+	memset(&stats, 0, sizeof(stats));
+	stats.flows = (uintptr_t)flows;
+	stats.max_flows = WPANTAP_FQ_FLOWS_MAX;
+	if (ioctl(fd, WPANTAPGETFQSTATS, &stats) < 0){
+		perror("WPANTAPGETFQSTATS");
+		close(fd);
+		return 1;
+	}
+
+	printf("fair queueing %s quantum %u bytes depth %u frames, %u flows, %u queued, %llu drops\n",
+		stats.enabled ? "on" : "off", stats.quantum, stats.depth, stats.nflows,
+		stats.queued, (unsigned long long)stats.drops);
+
+	for (uint32_t i = 0; i < stats.nflows && i < stats.max_flows; ++i){
+		struct wpantap_fq_flow_stats *f = &flows[i];
+		char name[32];
+
+		switch (f->mode){
+		case WPANTAP_FQ_ADDR_SHORT:
+			snprintf(name, sizeof(name), "%04x/%04x", f->pan, (unsigned int)f->addr);
+			break;
+		case WPANTAP_FQ_ADDR_EXT:
+			snprintf(name, sizeof(name), "%016llx", (unsigned long long)f->addr);
+			break;
+		default:
+			snprintf(name, sizeof(name), "(no source)");
+			break;
+		}
+		printf("%-18s ", name);
+		printf("queued %u frames %llu bytes %llu drops %llu\n", f->queued,
+			(unsigned long long)f->frames, (unsigned long long)f->bytes,
+			(unsigned long long)f->drops);
+	}
+
+	close(fd);
+	return 0;
+}
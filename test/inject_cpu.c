@@ -0,0 +1,73 @@
+/* gcc inject_cpu.c -o inject_cpu */
+
+/*
+ * Sets or shows the preferred injection CPU of a phy.
+ *
+ *   sudo ./inject_cpu -C 2            inject into every phy from CPU 2
+ *   sudo ./inject_cpu -p phy0 -C -1   let phy0 inject on the writer's CPU
+ *   sudo ./inject_cpu -p phy0         show the CPU of phy0 and the last one used
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+
+#include "../kmodule/wpantap.h"
+
+int main(int argc, char *argv[])
+{
+	struct wpantap_cpu_info info;
+	int set = 0;
+	int opt;
+
+	memset(&info, 0, sizeof(info));
+
+	while ((opt = getopt(argc, argv, "p:C:")) != -1){
+		switch (opt){
+		case 'p':
+			strncpy(info.phy, optarg, sizeof(info.phy) - 1);
+			break;
+		case 'C':
+			info.cpu = atoi(optarg);
+			set = 1;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-p phy] [-C cpu]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	int fd = open(WPANTAP_DEV_PATH, O_RDWR);
+	if (fd < 0){
+		perror("open");
+		printf("unable to open wpantap device\n");
+		return 1;
+	}
+
+	if (set && ioctl(fd, WPANTAPSETCPU, &info) < 0){
+		perror("WPANTAPSETCPU");
+		close(fd);
+		return 1;
+	}
+
+	if (ioctl(fd, WPANTAPGETCPU, &info) < 0){
+		perror("WPANTAPGETCPU");
+		close(fd);
+		return 1;
+	}
+
+	if (info.cpu == WPANTAP_CPU_ANY){
+		printf("%s: cpu any", info.phy);
+	}else{
+		printf("%s: cpu %d", info.phy, info.cpu);
+	}
+	printf(", last batch on cpu %d, queued %u, drops %llu\n", info.last_cpu,
+		info.queued, (unsigned long long)info.drops);
+
+	close(fd);
+	return 0;
+}
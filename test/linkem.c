@@ -0,0 +1,87 @@
+/* gcc linkem.c -o linkem */
+
+/*
+ * Sets or shows the link emulation profile of a phy.
+ *
+ *   sudo ./linkem -l 10000 -d 2000 -j 500 -a   1% loss, 2 ms +0..0.5 ms delay, airtime
+ *   sudo ./linkem -p phy0                      show the profile and counters of phy0
+ *   sudo ./linkem -c                           clear the profile of every phy
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+
+#include "../kmodule/wpantap.h"
+
+int main(int argc, char *argv[])
+{
+	struct wpantap_link_info info;
+	int set = 0;
+	int opt;
+
+	memset(&info, 0, sizeof(info));
+
+	while ((opt = getopt(argc, argv, "p:l:d:j:ac")) != -1){
+		switch (opt){
+		case 'p':
+			strncpy(info.phy, optarg, sizeof(info.phy) - 1);
+			break;
+		case 'l':
+			info.loss_ppm = atoi(optarg);
+			set = 1;
+			break;
+		case 'd':
+			info.delay_us = atoi(optarg);
+			set = 1;
+			break;
+		case 'j':
+			info.jitter_us = atoi(optarg);
+			set = 1;
+			break;
+		case 'a':
+			info.flags |= WPANTAP_LINK_AIRTIME;
+			set = 1;
+			break;
+		case 'c':
+			set = 1;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-p phy] [-l loss_ppm] [-d delay_us] [-j jitter_us] [-a] [-c]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	int fd = open(WPANTAP_DEV_PATH, O_RDWR);
+	if (fd < 0){
+		perror("open");
+		printf("unable to open wpantap device\n");
+		return 1;
+	}
+
+	if (set && ioctl(fd, WPANTAPSETLINK, &info) < 0){
+		perror("WPANTAPSETLINK");
+		close(fd);
+		return 1;
+	}
+
+	if (ioctl(fd, WPANTAPGETLINK, &info) < 0){
+		perror("WPANTAPGETLINK");
+		close(fd);
+		return 1;
+	}
+
+	printf("%s: loss %u ppm delay %u us jitter %u us airtime %s bitrate %u bit/s\n",
+		info.phy, info.loss_ppm, info.delay_us, info.jitter_us,
+		(info.flags & WPANTAP_LINK_AIRTIME) ? "on" : "off", info.bitrate);
+	printf("queued %u delivered %llu lost %llu drops %llu\n",
+		info.queued, (unsigned long long)info.delivered,
+		(unsigned long long)info.lost, (unsigned long long)info.drops);
+
+	close(fd);
+	return 0;
+}
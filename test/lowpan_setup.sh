@@ -1,24 +1,49 @@
 #!/bin/bash
 
+# Configures lowpan0 on top of wpan0 inside a network namespace.
+#
+#   ./lowpan_setup.sh          moves the phy of wpan0 into the namespace wpan0
+#   ./lowpan_setup.sh -n ns1   uses the phys of the driver instance of ns1
+#
+# With -n, the namespace is created if needed and the device is opened
+# from inside it once, which creates its own phys (and wpan0) there. Its
+# frames are read and written by processes started with "ip netns exec ns1",
+# separately from every other namespace.
+
 panid="0xbeef"
 
-iwpandev=`iwpan dev`
+if [ "$1" == "-n" ]; then
+	netns=$2
+	if [ -z "$netns" ]; then
+		echo "usage: $0 [-n netns]"
+		exit 1
+	fi
+
+	ip netns add $netns 2> /dev/null
+	# the first open from the namespace creates its phys
+	ip netns exec $netns sh -c ': <> /dev/net/wpantap'
 
-echo "WPAN Interface Info:"
-echo "$iwpandev"
+	echo "WPAN Interface Info:"
+	ip netns exec $netns iwpan dev
+else
+	netns="wpan0"
 
-PHYNUM=`echo "$iwpandev" | grep -B 1 wpan0 | sed -ne '1 s/phy#\([0-9]\)/\1/p'`
+	iwpandev=`iwpan dev`
 
-echo "WPAN PHY=${PHYNUM}"
+	echo "WPAN Interface Info:"
+	echo "$iwpandev"
 
-ip netns delete wpan0
-ip netns add wpan0
-iwpan phy${PHYNUM} set netns name wpan0
+	PHYNUM=`echo "$iwpandev" | grep -B 1 wpan0 | sed -ne '1 s/phy#\([0-9]\)/\1/p'`
 
+	echo "WPAN PHY=${PHYNUM}"
 
-ip netns exec wpan0 iwpan dev wpan0 set pan_id $panid
-ip netns exec wpan0 ip link add link wpan0 name lowpan0 type lowpan
-ip netns exec wpan0 ip link set wpan0 up
-ip netns exec wpan0 ip link set lowpan0 up
+	ip netns delete $netns
+	ip netns add $netns
+	iwpan phy${PHYNUM} set netns name $netns
+fi
 
 
+ip netns exec $netns iwpan dev wpan0 set pan_id $panid
+ip netns exec $netns ip link add link wpan0 name lowpan0 type lowpan
+ip netns exec $netns ip link set wpan0 up
+ip netns exec $netns ip link set lowpan0 up
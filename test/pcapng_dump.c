@@ -0,0 +1,60 @@
+/* gcc pcapng_dump.c -o pcapng_dump */
+
+/*
+ * Streams the traffic of wpan0 as pcapng to stdout, e.g.
+ *   sudo ./pcapng_dump -m > capture.pcapng
+ *   sudo ./pcapng_dump -m | wireshark -k -i -
+ * The driver emits the pcapng blocks itself, this program only copies them.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+
+#include "../kmodule/wpantap.h"
+
+int main(int argc, char *argv[])
+{
+	unsigned int format = WPANTAP_FMT_PCAPNG;
+	unsigned int depth = 0;
+	int mirror = 0;
+	char buf[65536];
+	ssize_t bytes;
+
+	if (argc > 1 && strcmp(argv[1], "-m") == 0){
+		/* do not steal frames from the bridge reading the device */
+		mirror = 1;
+	}
+
+	int fd = open(WPANTAP_DEV_PATH, mirror ? O_RDONLY : O_RDWR);
+	if (fd < 0){
+		perror("open");
+		fprintf(stderr, "unable to open wpantap device\n");
+		return 1;
+	}
+
+	if (mirror && ioctl(fd, WPANTAPATTACHMIRROR, &depth) < 0){
+		perror("ioctl");
+		close(fd);
+		return 1;
+	}
+
+	if (ioctl(fd, WPANTAPSETFORMAT, &format) < 0){
+		perror("ioctl");
+		close(fd);
+		return 1;
+	}
+
+	/* every read returns whole pcapng blocks */
+	while((bytes = read(fd, buf, sizeof(buf))) > 0){
+		if (write(STDOUT_FILENO, buf, bytes) != bytes){
+			break;
+		}
+	}
+
+	close(fd);
+	return 0;
+}
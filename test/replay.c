@@ -0,0 +1,174 @@
+/* gcc replay.c -o replay */
+
+/*
+ * Kernel-side traffic replay.
+ *
+ *   ./replay -g count,interval_us trace.bin   generate a trace of test frames
+ *   sudo ./replay [-s speed] trace.bin         replay with the original timing,
+ *                                              speed in 1/1000 (2000 is twice as fast)
+ *   sudo ./replay -r rate trace.bin            replay at rate frames/s (0: unlimited)
+ *   sudo ./replay -p phy1 trace.bin            replay into phy1 instead of the first phy
+ *
+ * The achieved rate and the lateness are printed when the replay ends.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "../kmodule/wpantap.h"
+
+/* same frame as test_write, the sequence number changes per record */
+static const unsigned char test_frame[] = {
+	0x21, 0xc8, 0x8b, 0xff, 0xff, 0x02, 0x00, 0x23, 0x00,
+	0x60, 0xe2, 0x16, 0x21, 0x1c, 0x4a, 0xc2, 0xae,
+	0xAA, 0xBB, 0xCC,
+};
+
+static int generate(const char *spec, const char *path)
+{
+	unsigned char rec[WPANTAP_TRACE_REC_SIZE(sizeof(test_frame))];
+	struct wpantap_trace_rec *hdr = (struct wpantap_trace_rec *)rec;
+	unsigned long count, interval_us;
+	FILE *out;
+
+	if (sscanf(spec, "%lu,%lu", &count, &interval_us) != 2){
+		fprintf(stderr, "expected -g count,interval_us\n");
+		return 1;
+	}
+
+	out = fopen(path, "wb");
+	if (out == NULL){
+		perror("fopen");
+		return 1;
+	}
+
+	for (unsigned long i = 0; i < count; ++i){
+		memset(rec, 0, sizeof(rec));
+		hdr->offset_ns = (uint64_t)i * interval_us * 1000;
+		hdr->len = sizeof(test_frame);
+		memcpy(hdr + 1, test_frame, sizeof(test_frame));
+		((unsigned char *)(hdr + 1))[2] = (unsigned char)i;
+		fwrite(rec, sizeof(rec), 1, out);
+	}
+
+	fclose(out);
+	return 0;
+}
+
+static int play(int fd, const char *path, struct wpantap_replay_cfg *cfg)
+{
+	struct wpantap_replay_load load;
+	struct wpantap_replay_stats stats;
+	struct stat st;
+	void *trace;
+	int tfd;
+
+	tfd = open(path, O_RDONLY);
+	if (tfd < 0 || fstat(tfd, &st) < 0){
+		perror("open trace");
+		return 1;
+	}
+
+	trace = malloc(st.st_size);
+	if (trace == NULL || read(tfd, trace, st.st_size) != st.st_size){
+		perror("read trace");
+		return 1;
+	}
+	close(tfd);
+
+	memset(&load, 0, sizeof(load));
+	load.data = (uintptr_t)trace;
+	load.len = st.st_size;
+
+	if (ioctl(fd, WPANTAPREPLAYLOAD, &load) < 0){
+		perror("WPANTAPREPLAYLOAD");
+		return 1;
+	}
+	free(trace);
+
+	if (ioctl(fd, WPANTAPREPLAYSTART, cfg) < 0){
+		perror("WPANTAPREPLAYSTART");
+		return 1;
+	}
+
+	do {
+		usleep(100000);
+		if (ioctl(fd, WPANTAPREPLAYSTATS, &stats) < 0){
+			perror("WPANTAPREPLAYSTATS");
+			return 1;
+		}
+	} while (stats.running);
+
+	printf("frames %llu bytes %llu drops %llu elapsed %llu ns\n",
+		(unsigned long long)stats.frames, (unsigned long long)stats.bytes,
+		(unsigned long long)stats.drops, (unsigned long long)stats.elapsed_ns);
+	printf("rate %llu frames/s late %llu max lateness %llu ns mean lateness %llu ns\n",
+		(unsigned long long)stats.rate, (unsigned long long)stats.late,
+		(unsigned long long)stats.max_lateness_ns,
+		stats.frames ? (unsigned long long)(stats.total_lateness_ns / stats.frames) : 0ULL);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct wpantap_replay_cfg cfg;
+	struct wpantap_phy_sel sel;
+	int opt, ret;
+
+	memset(&cfg, 0, sizeof(cfg));
+	memset(&sel, 0, sizeof(sel));
+	cfg.mode = WPANTAP_REPLAY_TIMED;
+	cfg.speed = 1000;
+
+	while ((opt = getopt(argc, argv, "g:s:r:p:")) != -1){
+		switch (opt){
+		case 'g':
+			if (optind >= argc){
+				break;
+			}
+			return generate(optarg, argv[optind]);
+		case 's':
+			cfg.speed = atoi(optarg);
+			break;
+		case 'r':
+			cfg.mode = WPANTAP_REPLAY_MAXRATE;
+			cfg.max_rate = atoi(optarg);
+			break;
+		case 'p':
+			strncpy(sel.phy, optarg, sizeof(sel.phy) - 1);
+			break;
+		default:
+			break;
+		}
+	}
+
+	if (optind >= argc){
+		fprintf(stderr, "usage: %s [-g count,interval_us] [-s speed] [-r rate] [-p phy] trace.bin\n", argv[0]);
+		return 1;
+	}
+
+	int fd = open(WPANTAP_DEV_PATH, O_RDWR);
+	if (fd < 0){
+		perror("open");
+		printf("unable to open wpantap device\n");
+		return 1;
+	}
+
+	if (sel.phy[0] != '\0' && ioctl(fd, WPANTAPSETPHY, &sel) < 0){
+		perror("WPANTAPSETPHY");
+		close(fd);
+		return 1;
+	}
+
+	ret = play(fd, argv[optind], &cfg);
+
+	close(fd);
+	return ret;
+}
@@ -0,0 +1,139 @@
+/* gcc -O2 ringbuf_bench.c -o ringbuf_bench */
+
+/*
+ * Microbenchmark of the driver ring buffer (kmodule/ringbuf.h) in user
+ * space, to iterate on the queue without loading the module.
+ *
+ *   -b bytes       ring size (default 4096, RINGBUF_SIZE of the driver)
+ *   -n iterations  insert/pop batches per point (default 200000)
+ *
+ * The ring is filled to each occupancy level with blocks of each frame
+ * size (plus the 8 byte timestamp stored by the driver), then batches of
+ * inserts and of pops (copy_first_data + pop_data, as the read path does)
+ * are timed around that level. The evict level inserts into a full ring,
+ * so that every insert pops the oldest block first.
+ *
+ * Prints CSV: ring_size,frame_size,occupancy,insert_ns,pop_ns
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../kmodule/ringbuf.h"
+
+#define BATCH 8
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// cost of one pair of now_ns() calls, subtracted from every batch
+static uint64_t clock_overhead(void)
+{
+	uint64_t start = now_ns();
+
+	for (int i = 0; i < 100000; ++i){
+		now_ns();
+	}
+	return (now_ns() - start) / 100000;
+}
+
+int main(int argc, char *argv[])
+{
+	static const int frame_sizes[] = { 5, 41, 64, 96, 127 };
+	static const int levels[] = { 0, 25, 50, 75, 90 };
+	int ring_size = RINGBUF_SIZE;
+	unsigned long iterations = 200000;
+	uint8_t frame[128], out[256];
+	uint64_t tstamp = 0, overhead;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "b:n:")) != -1){
+		switch (opt){
+		case 'b':
+			ring_size = atoi(optarg);
+			break;
+		case 'n':
+			iterations = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-b bytes] [-n iterations]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	memset(frame, 0xAA, sizeof(frame));
+	overhead = clock_overhead();
+
+	printf("ring_size,frame_size,occupancy,insert_ns,pop_ns\n");
+
+	for (size_t s = 0; s < sizeof(frame_sizes) / sizeof(frame_sizes[0]); ++s){
+		int len = frame_sizes[s];
+		int block = sizeof(int) + sizeof(tstamp) + len;
+		struct ringbuf_t rb;
+
+		if (ringbuf_init(&rb, ring_size) != 0 || block * BATCH > rb.capacity){
+			fprintf(stderr, "ring of %d bytes too small for %d byte frames\n", ring_size, len);
+			return 1;
+		}
+
+		for (size_t l = 0; l <= sizeof(levels) / sizeof(levels[0]); ++l){
+			int evict = l == sizeof(levels) / sizeof(levels[0]);
+			int fill = evict ? rb.capacity / block : (long)rb.capacity * levels[l] / 100 / block;
+			uint64_t insert_total = 0, pop_total = 0, t0, t1;
+
+			// the batches must fit above the level, except when evicting
+			if (!evict && (fill + BATCH) * block > rb.capacity){
+				fill = rb.capacity / block - BATCH;
+			}
+
+			rb.head = rb.tail = rb.buf;
+			for (int i = 0; i < fill; ++i){
+				ringbuf_insert_data2(&rb, sizeof(tstamp), &tstamp, len, frame);
+			}
+
+			for (unsigned long n = 0; n < iterations; ++n){
+				t0 = now_ns();
+				for (int i = 0; i < BATCH; ++i){
+					tstamp++;
+					ringbuf_insert_data2(&rb, sizeof(tstamp), &tstamp, len, frame);
+				}
+				t1 = now_ns();
+				insert_total += t1 - t0 - overhead;
+
+				if (evict){
+					continue;
+				}
+
+				t0 = now_ns();
+				for (int i = 0; i < BATCH; ++i){
+					ringbuf_copy_first_data(&rb, out);
+					ringbuf_pop_data(&rb);
+				}
+				t1 = now_ns();
+				pop_total += t1 - t0 - overhead;
+			}
+
+			if (evict){
+				printf("%d,%d,evict,%.1f,\n", ring_size, len,
+					(double)insert_total / (iterations * BATCH));
+			}else{
+				printf("%d,%d,%d,%.1f,%.1f\n", ring_size, len, levels[l],
+					(double)insert_total / (iterations * BATCH),
+					(double)pop_total / (iterations * BATCH));
+			}
+		}
+
+		ringbuf_deinit(&rb);
+	}
+
+	return 0;
+}
@@ -0,0 +1,204 @@
+/* clang -g -O1 -fsanitize=fuzzer,address ringbuf_fuzz.c -o ringbuf_fuzz */
+/* gcc -g -O1 -fsanitize=address -DRINGBUF_FUZZ_STANDALONE ringbuf_fuzz.c -o ringbuf_fuzz */
+
+/*
+ * libFuzzer harness of the driver ring buffer (kmodule/ringbuf.h).
+ *
+ * The input picks a small ring size, so that blocks and their size prefix
+ * wrap around often, then a sequence of inserts, pops and checks. Every
+ * operation is mirrored on a trivial FIFO model, the harness aborts when
+ * the ring buffer disagrees with it on contents, eviction or bytes used.
+ *
+ * The standalone build runs the given input files, or random inputs if
+ * there are none: ./ringbuf_fuzz [-n iterations] [file...]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ringbuf_err(args...) do {} while (0)
+#define ringbuf_warn(args...) do {} while (0)
+#include "../kmodule/ringbuf.h"
+
+#define MAX_RING 264
+#define MAX_BLOCKS MAX_RING
+
+struct model_block {
+	int len;
+	uint32_t seq;
+};
+
+static struct model_block blocks[MAX_BLOCKS];
+static int first, nblocks, used;
+
+static uint8_t pattern(uint32_t seq, int i)
+{
+	return (uint8_t)(seq * 31 + i);
+}
+
+static void model_pop(void)
+{
+	used -= sizeof(int) + blocks[first].len;
+	first = (first + 1) % MAX_BLOCKS;
+	nblocks--;
+}
+
+static void check(int cond)
+{
+	if (!cond){
+		abort();
+	}
+}
+
+static void check_first(struct ringbuf_t *rb)
+{
+	uint8_t buf[MAX_RING];
+	struct model_block *b = &blocks[first];
+
+	check(ringbuf_get_first_data_size(rb) == b->len);
+	check(ringbuf_copy_first_data(rb, buf) == b->len);
+	for (int i = 0; i < b->len; ++i){
+		check(buf[i] == pattern(b->seq, i));
+	}
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	struct ringbuf_t rb;
+	uint8_t seg1[16], seg2[256];
+	uint32_t seq = 0;
+	size_t pos = 1;
+
+	if (size < 1){
+		return 0;
+	}
+
+	// 8 to 263 bytes
+	if (ringbuf_init(&rb, 8 + data[0]) != 0){
+		return 0;
+	}
+	first = nblocks = used = 0;
+
+	while (pos < size){
+		uint8_t op = data[pos++];
+
+		switch (op & 3){
+		case 0:
+		case 1:{
+			int len1 = (op >> 2) % sizeof(seg1);
+			int len2 = pos < size ? data[pos++] : 0;
+			int len = len1 + len2;
+			int ret;
+
+			for (int i = 0; i < len1; ++i){
+				seg1[i] = pattern(seq, i);
+			}
+			for (int i = 0; i < len2; ++i){
+				seg2[i] = pattern(seq, len1 + i);
+			}
+
+			ret = ringbuf_insert_data2(&rb, len1, seg1, len2, seg2);
+
+			if (len == 0){
+				check(ret == 0);
+			}else if ((int)sizeof(int) + len > rb.capacity){
+				check(ret != 0);
+			}else{
+				check(ret == 0);
+				// the oldest blocks are evicted to make room
+				while (used + (int)sizeof(int) + len > rb.capacity){
+					model_pop();
+				}
+				blocks[(first + nblocks) % MAX_BLOCKS].len = len;
+				blocks[(first + nblocks) % MAX_BLOCKS].seq = seq;
+				nblocks++;
+				used += sizeof(int) + len;
+			}
+			seq++;
+			break;
+		}
+		case 2:
+			if (nblocks == 0){
+				check(ringbuf_is_empty(&rb));
+				check(ringbuf_pop_data(&rb) != 0);
+				break;
+			}
+			check_first(&rb);
+			check(ringbuf_pop_data(&rb) == 0);
+			model_pop();
+			break;
+		case 3:
+			if (nblocks > 0){
+				check_first(&rb);
+			}
+			break;
+		}
+
+		check(ringbuf_bytes_used(&rb) == used);
+		check(ringbuf_bytes_free(&rb) == rb.capacity - used);
+		check(rb.head >= rb.buf && rb.head < rb.end);
+		check(rb.tail >= rb.buf && rb.tail < rb.end);
+	}
+
+	// drain
+	while (nblocks > 0){
+		check_first(&rb);
+		check(ringbuf_pop_data(&rb) == 0);
+		model_pop();
+	}
+	check(ringbuf_is_empty(&rb));
+
+	ringbuf_deinit(&rb);
+	return 0;
+}
+
+#ifdef RINGBUF_FUZZ_STANDALONE
+
+#include <unistd.h>
+
+int main(int argc, char *argv[])
+{
+	static uint8_t buf[4096];
+	unsigned long iterations = 100000;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:")) != -1){
+		switch (opt){
+		case 'n':
+			iterations = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n iterations] [file...]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind < argc){
+		for (int i = optind; i < argc; ++i){
+			FILE *f = fopen(argv[i], "rb");
+			if (f == NULL){
+				perror(argv[i]);
+				return 1;
+			}
+			size_t len = fread(buf, 1, sizeof(buf), f);
+			fclose(f);
+			LLVMFuzzerTestOneInput(buf, len);
+		}
+		return 0;
+	}
+
+	srandom(1);
+	for (unsigned long n = 0; n < iterations; ++n){
+		size_t len = 1 + random() % sizeof(buf);
+		for (size_t i = 0; i < len; ++i){
+			buf[i] = (uint8_t)random();
+		}
+		LLVMFuzzerTestOneInput(buf, len);
+	}
+	printf("%lu inputs ok\n", iterations);
+	return 0;
+}
+
+#endif
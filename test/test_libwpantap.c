@@ -0,0 +1,74 @@
+/* gcc test_libwpantap.c ../lib/libwpantap.c -o test_libwpantap */
+
+/*
+ * Checks the parts of libwpantap that do not need the driver: the FCS
+ * against the CRC-16/KERMIT check value, and the META record parser on a
+ * well-formed batch and on truncated ones. Exits non-zero on a mismatch.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "../lib/libwpantap.h"
+
+#define CHECK(cond) do { \
+	if (!(cond)){ \
+		fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+		return 1; \
+	} \
+} while (0)
+
+static size_t put_record(uint8_t *buf, const char *data, uint64_t tstamp_ns)
+{
+	struct wpantap_meta meta = {
+		.tstamp_ns = tstamp_ns,
+		.len = strlen(data),
+	};
+
+	memset(buf, 0, WPANTAP_META_REC_SIZE(meta.len));
+	memcpy(buf, &meta, sizeof(meta));
+	memcpy(buf + sizeof(meta), data, meta.len);
+	return WPANTAP_META_REC_SIZE(meta.len);
+}
+
+int main(){
+
+	static const char *payloads[] = {"a", "0123456789", "abcdefgh"};
+	uint8_t frame[16] = "123456789";
+	uint8_t buf[256];
+	struct wpantap_frame_ref frames[4];
+	size_t len = 0;
+	int n;
+
+	CHECK(wpantap_fcs("123456789", 9) == 0x2189);
+	CHECK(wpantap_fcs_append(frame, 9) == 11);
+	CHECK(frame[9] == 0x89 && frame[10] == 0x21);
+	CHECK(wpantap_fcs_check(frame, 11));
+	frame[0] ^= 1;
+	CHECK(!wpantap_fcs_check(frame, 11));
+
+	for (int i = 0; i < 3; ++i){
+		len += put_record(buf + len, payloads[i], 1000 + i);
+	}
+
+	n = wpantap_meta_parse(buf, len, frames, 4);
+	CHECK(n == 3);
+	for (int i = 0; i < 3; ++i){
+		CHECK(frames[i].len == strlen(payloads[i]));
+		CHECK(memcmp(frames[i].data, payloads[i], frames[i].len) == 0);
+		CHECK(frames[i].tstamp_ns == 1000u + i);
+	}
+
+	// stops at max, the rest is left to the caller
+	CHECK(wpantap_meta_parse(buf, len, frames, 2) == 2);
+
+	// a record cut short is malformed
+	errno = 0;
+	CHECK(wpantap_meta_parse(buf, len - 1, frames, 4) == -1 && errno == EINVAL);
+	CHECK(wpantap_meta_parse(buf, 4, frames, 4) == -1);
+
+	printf("libwpantap: ok\n");
+	return 0;
+}
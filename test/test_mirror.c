@@ -0,0 +1,65 @@
+/* gcc test_mirror.c -o test_mirror */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+
+#include "../kmodule/wpantap.h"
+
+static volatile sig_atomic_t stop = 0;
+
+static void sig_int(int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+int main(int argc, char *argv[])
+{
+	struct wpantap_mirror_stats stats;
+	unsigned int depth = WPANTAP_MIRROR_DEPTH_DEFAULT;
+	char buf[300];
+	int bytes;
+
+	if (argc > 1){
+		depth = atoi(argv[1]);
+	}
+
+	int fd = open(WPANTAP_DEV_PATH, O_RDONLY);
+	if (fd < 0){
+		perror("open");
+		printf("unable to open wpantap device\n");
+		return 1;
+	}
+
+	/* frames read from this fd are copies, the real reader still gets them */
+	if (ioctl(fd, WPANTAPATTACHMIRROR, &depth) < 0){
+		perror("ioctl");
+		close(fd);
+		return 1;
+	}
+
+	signal(SIGINT, sig_int);
+
+	while(!stop){
+		bytes = read(fd, buf, sizeof(buf));
+		if (bytes < 0){
+			break;
+		}
+		printf("mirrored %d bytes\n", bytes);
+	}
+
+	if (ioctl(fd, WPANTAPGETMIRRORSTATS, &stats) == 0){
+		printf("depth %u queued %u frames %llu drops %llu\n",
+			stats.depth, stats.queued,
+			(unsigned long long)stats.frames,
+			(unsigned long long)stats.drops);
+	}
+
+	close(fd);
+	return 0;
+}
@@ -1,3 +1,10 @@
+/* gcc test_write.c -o test_write */
+
+/*
+ * Writes one test frame. With numlbs > 1, ./test_write phy1 writes it to
+ * phy1 instead of the first phy that is up.
+ */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -15,7 +22,9 @@
 #include <errno.h>
 #include <stdarg.h>
 
-int main(){
+#include "../kmodule/wpantap.h"
+
+int main(int argc, char *argv[]){
 
 	int fd = open("/dev/net/wpantap", O_RDWR);
 	if (fd < 0){
@@ -23,6 +32,18 @@ int main(){
 		printf("unable to open wpantap device\n");
 		return 1;
 	}
+
+	if (argc > 1){
+		struct wpantap_phy_sel sel;
+
+		memset(&sel, 0, sizeof(sel));
+		strncpy(sel.phy, argv[1], sizeof(sel.phy) - 1);
+		if (ioctl(fd, WPANTAPSETPHY, &sel) < 0){
+			perror("WPANTAPSETPHY");
+			close(fd);
+			return 1;
+		}
+	}
 	
 	char buf[20];
 
@@ -0,0 +1,116 @@
+/* gcc tunnel.c -o tunnel */
+
+/*
+ * Sets or shows the in-kernel UDP tunnel of a phy.
+ *
+ *   sudo ./tunnel -l 12001 -r 10.0.2.6:12001   tunnel phy0 to one remote
+ *   sudo ./tunnel -l 12001 -r a:p -r b:p -k    two remotes, keep frames readable
+ *   sudo ./tunnel -p phy0                      show the tunnel and counters
+ *   sudo ./tunnel -c                           remove the tunnel
+ *
+ * The tunnel and its socket belong to the network namespace of this
+ * program, run it with "ip netns exec" for the phys of another namespace.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+
+#include "../kmodule/wpantap.h"
+
+static int parse_remote(char *arg, struct wpantap_tunnel_remote *remote)
+{
+	char *colon = strrchr(arg, ':');
+	struct in_addr addr;
+
+	if (colon == NULL){
+		return -1;
+	}
+	*colon = '\0';
+	if (inet_pton(AF_INET, arg, &addr) != 1){
+		return -1;
+	}
+	remote->addr = addr.s_addr;
+	remote->port = atoi(colon + 1);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct wpantap_tunnel_info info;
+	int set = 0;
+	int opt;
+
+	memset(&info, 0, sizeof(info));
+
+	while ((opt = getopt(argc, argv, "p:l:r:kc")) != -1){
+		switch (opt){
+		case 'p':
+			strncpy(info.phy, optarg, sizeof(info.phy) - 1);
+			break;
+		case 'l':
+			info.local_port = atoi(optarg);
+			set = 1;
+			break;
+		case 'r':
+			if (info.nremotes == WPANTAP_TUNNEL_REMOTES_MAX ||
+			    parse_remote(optarg, &info.remotes[info.nremotes]) != 0){
+				fprintf(stderr, "invalid remote %s\n", optarg);
+				return 1;
+			}
+			info.nremotes++;
+			set = 1;
+			break;
+		case 'k':
+			info.flags |= WPANTAP_TUNNEL_RING;
+			break;
+		case 'c':
+			set = 1;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-p phy] [-l local_port] [-r ip:port]... [-k] [-c]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	int fd = open(WPANTAP_DEV_PATH, O_RDWR);
+	if (fd < 0){
+		perror("open");
+		printf("unable to open wpantap device\n");
+		return 1;
+	}
+
+	if (set && ioctl(fd, WPANTAPSETTUNNEL, &info) < 0){
+		perror("WPANTAPSETTUNNEL");
+		close(fd);
+		return 1;
+	}
+
+	if (ioctl(fd, WPANTAPGETTUNNEL, &info) < 0){
+		perror("WPANTAPGETTUNNEL");
+		close(fd);
+		return 1;
+	}
+
+	if (info.local_port == 0){
+		printf("%s: no tunnel\n", info.phy);
+	}else{
+		printf("%s: local port %u%s\n", info.phy, info.local_port,
+			(info.flags & WPANTAP_TUNNEL_RING) ? ", frames kept readable" : "");
+		for (int i = 0; i < info.nremotes; ++i){
+			struct in_addr addr = { .s_addr = info.remotes[i].addr };
+			printf("  remote %s:%u\n", inet_ntoa(addr), info.remotes[i].port);
+		}
+		printf("tx %llu (errors %llu) rx %llu (errors %llu)\n",
+			(unsigned long long)info.tx_frames, (unsigned long long)info.tx_errors,
+			(unsigned long long)info.rx_frames, (unsigned long long)info.rx_errors);
+	}
+
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,79 @@
+#!/bin/bash
+
+# Checks the in-kernel UDP tunnel between two network namespaces.
+#
+# The initial namespace (10.99.0.1) and wt1 (10.99.0.2) are joined by a
+# veth pair. The tunnel of phy0 lives in the initial namespace, like the
+# phy, and sends to a UDP peer in wt1 that counts the datagrams and sends
+# frames back.
+#
+#   wpan0 --bench_gen--> phy0 tunnel --UDP--> peer (wt1)
+#   peer (wt1) --UDP--> phy0 tunnel --> wpan0 --bench_sink-->
+#
+# usage: sudo ./tunnel_netns.sh [count]
+
+count=${1:-1000}
+port=5400
+
+cd "$(dirname "$0")"
+
+for prog in tunnel bench_gen bench_sink; do
+	if [ ! -x $prog ]; then
+		gcc -O2 -pthread $prog.c -o $prog || exit 1
+	fi
+done
+
+cleanup()
+{
+	./tunnel -c > /dev/null
+	ip link delete veth-wt0 2> /dev/null
+	ip netns delete wt1 2> /dev/null
+	rm -f peer.out sink.out
+}
+trap cleanup EXIT
+
+ip netns add wt1
+ip link add veth-wt0 type veth peer name veth-wt1
+ip link set veth-wt1 netns wt1
+ip addr add 10.99.0.1/24 dev veth-wt0
+ip netns exec wt1 ip addr add 10.99.0.2/24 dev veth-wt1
+ip link set veth-wt0 up
+ip netns exec wt1 ip link set veth-wt1 up
+ip link set wpan0 up
+
+./tunnel -l $port -r 10.99.0.2:$port || exit 1
+
+# the peer in wt1: counts the frames of the driver, then sends them back
+ip netns exec wt1 python3 - $port $count > peer.out <<'EOF' &
+import socket, sys, time
+port, count = int(sys.argv[1]), int(sys.argv[2])
+sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+sock.bind(('10.99.0.2', port))
+sock.settimeout(3)
+frames = []
+try:
+    while len(frames) < count:
+        buf, _ = sock.recvfrom(2048)
+        frames.append(buf)
+except socket.timeout:
+    pass
+print(len(frames))
+sys.stdout.flush()
+# give the sink time to start, it would count the sent frames too
+time.sleep(1)
+for buf in frames:
+    sock.sendto(buf, ('10.99.0.1', port))
+EOF
+peer=$!
+sleep 0.5
+
+./bench_gen -m packet -n $count -r 10000 > /dev/null
+
+./bench_sink -m packet -n $count -t 10 -l tunnel > sink.out &
+sink=$!
+wait $peer
+wait $sink
+
+echo "frames tunneled to wt1: $(cat peer.out) of $count"
+echo "frames tunneled back to wpan0 (bench_sink): $(cut -d, -f3 sink.out)"
+./tunnel
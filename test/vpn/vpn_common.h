@@ -0,0 +1,397 @@
+/*
+ * Shared code of the native bridge daemons (vpn_p2p, vpn_switch).
+ *
+ * The daemons speak the wire format of vpn_p2p.py: one frame per UDP
+ * datagram, with its FCS (or several, see the aggregated format below).
+ * They talk to the driver in the WPANTAP_FMT_META format, so that one
+ * read() returns a batch of frames and one writev() injects a batch of
+ * frames.
+ */
+
+#ifndef VPN_COMMON_H
+#define VPN_COMMON_H
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include "../../kmodule/wpantap.h"
+
+/* datagrams moved per recvmmsg/sendmmsg */
+#define VPN_BATCH 64
+#define VPN_FCS_LEN 2
+/* longest frame accepted from the network, with FCS */
+#define VPN_FRAME_MAX WPANTAP_FRAME_MAX
+#define VPN_SOCK_BUF (4 * 1024 * 1024)
+
+
+/*
+ * Minimal JSON reader, enough for the config files: objects, arrays,
+ * strings without unicode escapes, and numbers.
+ */
+
+static inline const char *vpn_json_ws(const char *p)
+{
+	while (*p && isspace((unsigned char)*p)){
+		p++;
+	}
+	return p;
+}
+
+/* returns the end of the value at p, or NULL if it is malformed */
+static inline const char *vpn_json_skip(const char *p)
+{
+	int depth = 0;
+
+	p = vpn_json_ws(p);
+	do {
+		if (*p == '\0'){
+			return NULL;
+		}else if (*p == '"'){
+			for (p++; *p != '"'; p++){
+				if (*p == '\0'){
+					return NULL;
+				}
+				if (*p == '\\' && p[1] != '\0'){
+					p++;
+				}
+			}
+			p++;
+		}else if (*p == '{' || *p == '['){
+			depth++;
+			p++;
+		}else if (*p == '}' || *p == ']'){
+			depth--;
+			p++;
+		}else if (depth > 0){
+			p++;
+		}else{
+			/* number or literal */
+			while (*p && *p != ',' && *p != '}' && *p != ']' && !isspace((unsigned char)*p)){
+				p++;
+			}
+		}
+	} while (depth > 0);
+
+	return p;
+}
+
+/* returns the value of key in the object at p, or NULL */
+static inline const char *vpn_json_key(const char *p, const char *key)
+{
+	size_t len = strlen(key);
+
+	p = vpn_json_ws(p);
+	if (*p != '{'){
+		return NULL;
+	}
+	p = vpn_json_ws(p + 1);
+
+	while (*p == '"'){
+		const char *name = p + 1;
+		const char *value;
+
+		p = vpn_json_skip(p);
+		if (p == NULL){
+			return NULL;
+		}
+		p = vpn_json_ws(p);
+		if (*p != ':'){
+			return NULL;
+		}
+		value = vpn_json_ws(p + 1);
+
+		if ((size_t)(p - name) >= len + 1 && strncmp(name, key, len) == 0 && name[len] == '"'){
+			return value;
+		}
+
+		p = vpn_json_skip(value);
+		if (p == NULL){
+			return NULL;
+		}
+		p = vpn_json_ws(p);
+		if (*p == ','){
+			p = vpn_json_ws(p + 1);
+		}
+	}
+
+	return NULL;
+}
+
+/* returns the i-th element of the array at p, or NULL */
+static inline const char *vpn_json_index(const char *p, int i)
+{
+	p = vpn_json_ws(p);
+	if (*p != '['){
+		return NULL;
+	}
+	p = vpn_json_ws(p + 1);
+
+	while (*p != ']' && *p != '\0'){
+		if (i-- == 0){
+			return p;
+		}
+		p = vpn_json_skip(p);
+		if (p == NULL){
+			return NULL;
+		}
+		p = vpn_json_ws(p);
+		if (*p == ','){
+			p = vpn_json_ws(p + 1);
+		}
+	}
+
+	return NULL;
+}
+
+/* copies the string at p into out, returns 0 on success */
+static inline int vpn_json_string(const char *p, char *out, size_t size)
+{
+	const char *end;
+
+	if (p == NULL || *p != '"'){
+		return -1;
+	}
+	end = vpn_json_skip(p);
+	if (end == NULL || (size_t)(end - p - 2) >= size){
+		return -1;
+	}
+	memcpy(out, p + 1, end - p - 2);
+	out[end - p - 2] = '\0';
+	return 0;
+}
+
+/* reads {"ip": ..., "port": ...} at p, returns 0 on success */
+static inline int vpn_json_endpoint(const char *p, struct sockaddr_in *sa)
+{
+	const char *port = vpn_json_key(p, "port");
+	char ip[64];
+
+	if (vpn_json_string(vpn_json_key(p, "ip"), ip, sizeof(ip)) != 0 || port == NULL){
+		return -1;
+	}
+
+	memset(sa, 0, sizeof(*sa));
+	sa->sin_family = AF_INET;
+	sa->sin_port = htons((uint16_t)atoi(port));
+	return inet_pton(AF_INET, ip, &sa->sin_addr) == 1 ? 0 : -1;
+}
+
+/* reads a whole file into a NUL terminated string, NULL on failure */
+static inline char *vpn_read_file(const char *path)
+{
+	struct stat st;
+	char *buf;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0){
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0 || (buf = malloc(st.st_size + 1)) == NULL){
+		close(fd);
+		return NULL;
+	}
+	if (read(fd, buf, st.st_size) != st.st_size){
+		free(buf);
+		close(fd);
+		return NULL;
+	}
+	buf[st.st_size] = '\0';
+	close(fd);
+	return buf;
+}
+
+
+/* opens the driver in non-blocking mode with the metadata format */
+static inline int vpn_open_tap(void)
+{
+	unsigned int format = WPANTAP_FMT_META;
+	int fd;
+
+	fd = open(WPANTAP_DEV_PATH, O_RDWR | O_NONBLOCK);
+	if (fd < 0){
+		return -1;
+	}
+	if (ioctl(fd, WPANTAPSETFORMAT, &format) < 0){
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* opens a UDP socket bound to sa, shared by the workers with SO_REUSEPORT */
+static inline int vpn_open_udp(const struct sockaddr_in *sa)
+{
+	int one = 1, size = VPN_SOCK_BUF;
+	int sd;
+
+	sd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+	if (sd < 0){
+		return -1;
+	}
+	setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	setsockopt(sd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+	setsockopt(sd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	setsockopt(sd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+
+	if (bind(sd, (const struct sockaddr *)sa, sizeof(*sa)) < 0){
+		close(sd);
+		return -1;
+	}
+	return sd;
+}
+
+/* parses a comma separated CPU list, returns the number of CPUs */
+static inline int vpn_parse_cpus(char *list, int *cpus, int max)
+{
+	int n = 0;
+
+	for (char *tok = strtok(list, ","); tok && n < max; tok = strtok(NULL, ",")){
+		cpus[n++] = atoi(tok);
+	}
+	return n;
+}
+
+static inline void vpn_pin_cpu(int cpu)
+{
+	cpu_set_t set;
+
+	if (cpu < 0){
+		return;
+	}
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+
+/*
+ * Builds the writev() vector injecting one frame received from the network
+ * (with FCS) in the metadata format: header, frame without FCS, padding.
+ * Returns the number of iovecs used, 0 if the datagram is not a frame.
+ */
+static inline int vpn_meta_iov(struct iovec *iov, struct wpantap_meta *meta, void *frame, unsigned int len)
+{
+	static const uint8_t pad[WPANTAP_META_ALIGN];
+	size_t padding;
+
+	if (len <= VPN_FCS_LEN || len > VPN_FRAME_MAX){
+		return 0;
+	}
+
+	meta->tstamp_ns = 0;
+	meta->len = len - VPN_FCS_LEN;
+	meta->flags = 0;
+
+	iov[0].iov_base = meta;
+	iov[0].iov_len = sizeof(*meta);
+	iov[1].iov_base = frame;
+	iov[1].iov_len = meta->len;
+
+	padding = WPANTAP_META_REC_SIZE(meta->len) - sizeof(*meta) - meta->len;
+	if (padding == 0){
+		return 2;
+	}
+	iov[2].iov_base = (void *)pad;
+	iov[2].iov_len = padding;
+	return 3;
+}
+
+
+/*
+ * Aggregated wire format (vpn_p2p -a): several frames per datagram. The
+ * datagram starts with a struct vpn_agg_hdr, then each frame (with its FCS)
+ * follows its length, 2 bytes in network byte order. A frame that does not
+ * fit in an empty aggregate is sent alone in the plain format, and a
+ * datagram that does not parse as an aggregate is taken as a plain frame,
+ * so an aggregating daemon still talks to the plain ones. vpn_switch splits
+ * the aggregates it receives and forwards their frames in the plain format.
+ */
+#define VPN_AGG_MAGIC0 'W'
+#define VPN_AGG_MAGIC1 'A'
+#define VPN_AGG_MTU_MIN 256
+#define VPN_AGG_MTU_MAX 9000
+/* most frames an aggregate can carry, all of them the shortest */
+#define VPN_AGG_FRAMES_MAX ((VPN_AGG_MTU_MAX - sizeof(struct vpn_agg_hdr)) / (2 + VPN_FCS_LEN + 1))
+
+struct vpn_agg_hdr {
+	uint8_t magic[2];
+	uint16_t count;		/* network byte order */
+};
+
+/* starts an empty aggregate at buf, returns its length */
+static inline size_t vpn_agg_init(uint8_t *buf)
+{
+	struct vpn_agg_hdr hdr = { { VPN_AGG_MAGIC0, VPN_AGG_MAGIC1 }, 0 };
+
+	memcpy(buf, &hdr, sizeof(hdr));
+	return sizeof(hdr);
+}
+
+/* appends a frame to the aggregate of len bytes at buf, returns the new length */
+static inline size_t vpn_agg_put(uint8_t *buf, size_t len, const void *frame, uint16_t frame_len)
+{
+	struct vpn_agg_hdr *hdr = (struct vpn_agg_hdr *)buf;
+	uint16_t be_len = htons(frame_len);
+
+	memcpy(buf + len, &be_len, sizeof(be_len));
+	memcpy(buf + len + sizeof(be_len), frame, frame_len);
+	hdr->count = htons(ntohs(hdr->count) + 1);
+	return len + sizeof(be_len) + frame_len;
+}
+
+/*
+ * Splits the aggregate of len bytes at buf into frames (with FCS), returns
+ * the number of frames, or -1 if the datagram is not a whole aggregate of
+ * at most max frames.
+ */
+static inline int vpn_agg_parse(uint8_t *buf, size_t len, struct iovec *frames, int max)
+{
+	struct vpn_agg_hdr hdr;
+	size_t pos = sizeof(hdr);
+	int count;
+
+	if (len < sizeof(hdr)){
+		return -1;
+	}
+	memcpy(&hdr, buf, sizeof(hdr));
+	count = ntohs(hdr.count);
+	if (hdr.magic[0] != VPN_AGG_MAGIC0 || hdr.magic[1] != VPN_AGG_MAGIC1 || count == 0 || count > max){
+		return -1;
+	}
+
+	for (int i = 0; i < count; ++i){
+		uint16_t frame_len;
+
+		if (len - pos < sizeof(frame_len)){
+			return -1;
+		}
+		memcpy(&frame_len, buf + pos, sizeof(frame_len));
+		frame_len = ntohs(frame_len);
+		pos += sizeof(frame_len);
+		if (frame_len > len - pos){
+			return -1;
+		}
+		frames[i].iov_base = buf + pos;
+		frames[i].iov_len = frame_len;
+		pos += frame_len;
+	}
+
+	return pos == len ? count : -1;
+}
+
+#endif /* VPN_COMMON_H */
@@ -0,0 +1,508 @@
+/* gcc -O2 -pthread vpn_p2p.c -o vpn_p2p */
+
+/*
+ * Native P2P VPN, a drop-in replacement of vpn_p2p.py (same config file,
+ * same wire format) built for throughput.
+ *
+ *   -c config   config file (default vpn_p2p_config.json)
+ *   -w workers  worker threads (default 1)
+ *   -C cpus     pin the workers round-robin to a comma separated CPU list
+ *   -a mtu      aggregate frames into datagrams of up to mtu bytes
+ *   -d usec     flush a partial aggregate this long after its first frame
+ *               (default 100, 0 sends what one read() returned right away)
+ *
+ * Each worker owns a driver fd and a UDP socket bound to the same address
+ * (SO_REUSEPORT) and waits on both with epoll. Frames are moved in batches,
+ * a read() of the driver and a sendmmsg() toward the peer, a recvmmsg()
+ * and a writev() into the driver, straight from buffers allocated at
+ * startup. The workers share the driver queue; the kernel spreads the
+ * datagrams over their sockets by flow.
+ *
+ * With -a, the frames of a read() are packed into as few datagrams as the
+ * MTU allows (see the aggregated format in vpn_common.h). The last
+ * datagram waits for the next read() until its deadline, armed on a
+ * timerfd, expires. Aggregates received are split into one writev().
+ * Both ends must use -a: a daemon without it takes an aggregate for a
+ * frame, while a daemon with it still accepts plain frames.
+ *
+ * Counters are printed on Ctrl-C.
+ */
+
+/* first, it defines _GNU_SOURCE */
+#include "vpn_common.h"
+
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+
+#define MAX_WORKERS 64
+#define IEEE802154_MTU 127
+/* a driver read returns whole records, at least one of the longest frame */
+#define TAP_BUF_SIZE (VPN_BATCH * WPANTAP_META_REC_SIZE(IEEE802154_MTU) + WPANTAP_META_REC_SIZE(WPANTAP_FRAME_MAX))
+/* frames injected per writev(), 3 iovecs each */
+#define TAP_FRAMES 256
+
+struct worker {
+	pthread_t thread;
+	int cpu;
+	int tapfd;
+	int sock;
+	int epfd;
+	int timerfd;
+
+	/* driver -> network */
+	uint8_t tap_buf[TAP_BUF_SIZE];
+	struct mmsghdr out_msgs[VPN_BATCH];
+	struct iovec out_iov[VPN_BATCH];
+
+	/* driver -> network, aggregated; the last datagram is open when agg_open is set */
+	uint8_t agg_buf[VPN_BATCH][VPN_AGG_MTU_MAX];
+	uint16_t agg_frames[VPN_BATCH];
+	int nagg;
+	int agg_open;
+
+	/* network -> driver */
+	uint8_t in_buf[VPN_BATCH][VPN_AGG_MTU_MAX];
+	struct mmsghdr in_msgs[VPN_BATCH];
+	struct iovec in_iov[VPN_BATCH];
+	struct iovec agg_iov[VPN_AGG_FRAMES_MAX];
+	struct wpantap_meta in_meta[TAP_FRAMES];
+	struct iovec tap_iov[TAP_FRAMES * 3];
+	int tap_frames, tap_niov;
+
+	unsigned long tx_frames, tx_errors, tx_datagrams;
+	unsigned long rx_frames, rx_errors, rx_datagrams;
+};
+
+static struct sockaddr_in my_addr, peer_addr;
+/* aggregate size in bytes, 0 sends one frame per datagram */
+static int agg_mtu;
+static long agg_deadline_us = 100;
+static volatile sig_atomic_t running = 1;
+
+static void sig_int(int sig)
+{
+	(void)sig;
+	running = 0;
+}
+
+/* driver -> peer, one frame per datagram */
+static void tap_to_net(struct worker *w)
+{
+	ssize_t bytes = read(w->tapfd, w->tap_buf, sizeof(w->tap_buf));
+	uint8_t *p = w->tap_buf;
+	uint8_t *end;
+	int n = 0;
+
+	if (bytes <= 0){
+		return;
+	}
+	end = p + bytes;
+
+	while (p < end){
+		struct wpantap_meta *meta = (struct wpantap_meta *)p;
+
+		w->out_iov[n].iov_base = p + sizeof(*meta);
+		w->out_iov[n].iov_len = meta->len;
+		n++;
+		p += WPANTAP_META_REC_SIZE(meta->len);
+
+		if (n == VPN_BATCH || p >= end){
+			int sent = sendmmsg(w->sock, w->out_msgs, n, 0);
+
+			if (sent < 0){
+				w->tx_errors += n;
+			}else{
+				w->tx_frames += sent;
+				w->tx_datagrams += sent;
+				w->tx_errors += n - sent;
+			}
+			n = 0;
+		}
+	}
+}
+
+static void agg_arm(struct worker *w, long usec)
+{
+	struct itimerspec its = {
+		.it_value = { usec / 1000000, (usec % 1000000) * 1000 },
+	};
+
+	timerfd_settime(w->timerfd, 0, &its, NULL);
+}
+
+/* sends the first n datagrams, the rest move to the front */
+static void agg_send(struct worker *w, int n)
+{
+	int sent = 0;
+
+	if (n == 0){
+		return;
+	}
+
+	while (sent < n){
+		int ret = sendmmsg(w->sock, w->out_msgs + sent, n - sent, 0);
+
+		if (ret <= 0){
+			break;
+		}
+		sent += ret;
+	}
+	for (int i = 0; i < n; ++i){
+		if (i < sent){
+			w->tx_frames += w->agg_frames[i];
+		}else{
+			w->tx_errors += w->agg_frames[i];
+		}
+	}
+	w->tx_datagrams += sent;
+
+	// only the open aggregate can be left
+	if (n < w->nagg){
+		memcpy(w->agg_buf[0], w->agg_buf[n], w->out_iov[n].iov_len);
+		w->out_iov[0].iov_len = w->out_iov[n].iov_len;
+		w->agg_frames[0] = w->agg_frames[n];
+	}
+	w->nagg -= n;
+}
+
+static void agg_add(struct worker *w, const uint8_t *frame, uint16_t len)
+{
+	struct iovec *iov;
+
+	if (w->agg_open){
+		iov = &w->out_iov[w->nagg - 1];
+		if (iov->iov_len + sizeof(uint16_t) + len <= (size_t)agg_mtu){
+			iov->iov_len = vpn_agg_put(w->agg_buf[w->nagg - 1], iov->iov_len, frame, len);
+			w->agg_frames[w->nagg - 1]++;
+			return;
+		}
+		w->agg_open = 0;
+	}
+
+	if (w->nagg == VPN_BATCH){
+		agg_send(w, w->nagg);
+	}
+	iov = &w->out_iov[w->nagg];
+	w->agg_frames[w->nagg] = 1;
+
+	if (sizeof(struct vpn_agg_hdr) + sizeof(uint16_t) + len > (size_t)agg_mtu){
+		// alone in the plain format
+		memcpy(w->agg_buf[w->nagg], frame, len);
+		iov->iov_len = len;
+		w->nagg++;
+		return;
+	}
+
+	iov->iov_len = vpn_agg_put(w->agg_buf[w->nagg], vpn_agg_init(w->agg_buf[w->nagg]), frame, len);
+	w->nagg++;
+	w->agg_open = 1;
+	if (agg_deadline_us > 0){
+		agg_arm(w, agg_deadline_us);
+	}
+}
+
+/* driver -> peer, aggregated */
+static void tap_to_net_agg(struct worker *w)
+{
+	ssize_t bytes = read(w->tapfd, w->tap_buf, sizeof(w->tap_buf));
+	uint8_t *p = w->tap_buf;
+	uint8_t *end;
+
+	if (bytes <= 0){
+		return;
+	}
+	end = p + bytes;
+
+	while (p < end){
+		struct wpantap_meta *meta = (struct wpantap_meta *)p;
+
+		agg_add(w, p + sizeof(*meta), meta->len);
+		p += WPANTAP_META_REC_SIZE(meta->len);
+	}
+
+	// full datagrams leave now, the open one waits for its deadline
+	if (agg_deadline_us == 0){
+		w->agg_open = 0;
+	}
+	agg_send(w, w->agg_open ? w->nagg - 1 : w->nagg);
+}
+
+/* the deadline of the open aggregate expired */
+static void agg_timeout(struct worker *w)
+{
+	uint64_t expirations;
+
+	if (read(w->timerfd, &expirations, sizeof(expirations)) < 0){
+		return;
+	}
+	w->agg_open = 0;
+	agg_send(w, w->nagg);
+}
+
+static void tap_flush(struct worker *w)
+{
+	if (w->tap_frames == 0){
+		return;
+	}
+	if (writev(w->tapfd, w->tap_iov, w->tap_niov) < 0){
+		w->rx_errors += w->tap_frames;
+	}else{
+		w->rx_frames += w->tap_frames;
+	}
+	w->tap_frames = 0;
+	w->tap_niov = 0;
+}
+
+static void tap_put(struct worker *w, void *frame, unsigned int len)
+{
+	int used;
+
+	if (w->tap_frames == TAP_FRAMES){
+		tap_flush(w);
+	}
+	used = vpn_meta_iov(&w->tap_iov[w->tap_niov], &w->in_meta[w->tap_frames], frame, len);
+	if (used == 0){
+		w->rx_errors++;
+		return;
+	}
+	w->tap_niov += used;
+	w->tap_frames++;
+}
+
+/* peer -> driver */
+static void net_to_tap(struct worker *w)
+{
+	int received;
+
+	received = recvmmsg(w->sock, w->in_msgs, VPN_BATCH, MSG_DONTWAIT, NULL);
+	if (received <= 0){
+		return;
+	}
+	w->rx_datagrams += received;
+
+	for (int i = 0; i < received; ++i){
+		unsigned int len = w->in_msgs[i].msg_len;
+		int n = -1;
+
+		if (w->in_msgs[i].msg_hdr.msg_flags & MSG_TRUNC){
+			w->rx_errors++;
+			continue;
+		}
+		if (agg_mtu > 0){
+			n = vpn_agg_parse(w->in_buf[i], len, w->agg_iov, VPN_AGG_FRAMES_MAX);
+		}
+		if (n < 0){
+			tap_put(w, w->in_buf[i], len);
+			continue;
+		}
+		for (int j = 0; j < n; ++j){
+			tap_put(w, w->agg_iov[j].iov_base, w->agg_iov[j].iov_len);
+		}
+	}
+
+	tap_flush(w);
+}
+
+static void *worker_run(void *arg)
+{
+	struct worker *w = arg;
+	struct epoll_event events[3];
+
+	vpn_pin_cpu(w->cpu);
+
+	while (running){
+		int n = epoll_wait(w->epfd, events, 3, 200);
+
+		for (int i = 0; i < n; ++i){
+			if (events[i].data.fd == w->tapfd){
+				if (agg_mtu > 0){
+					tap_to_net_agg(w);
+				}else{
+					tap_to_net(w);
+				}
+			}else if (events[i].data.fd == w->timerfd){
+				agg_timeout(w);
+			}else{
+				net_to_tap(w);
+			}
+		}
+	}
+
+	return NULL;
+}
+
+static int worker_init(struct worker *w, int cpu)
+{
+	struct epoll_event ev;
+
+	w->cpu = cpu;
+	w->tapfd = vpn_open_tap();
+	if (w->tapfd < 0){
+		perror("unable to open wpantap device");
+		return -1;
+	}
+	w->sock = vpn_open_udp(&my_addr);
+	if (w->sock < 0){
+		perror("unable to bind UDP socket");
+		return -1;
+	}
+
+	for (int i = 0; i < VPN_BATCH; ++i){
+		w->out_msgs[i].msg_hdr.msg_name = &peer_addr;
+		w->out_msgs[i].msg_hdr.msg_namelen = sizeof(peer_addr);
+		w->out_msgs[i].msg_hdr.msg_iov = &w->out_iov[i];
+		w->out_msgs[i].msg_hdr.msg_iovlen = 1;
+		if (agg_mtu > 0){
+			w->out_iov[i].iov_base = w->agg_buf[i];
+		}
+
+		w->in_iov[i].iov_base = w->in_buf[i];
+		// a plain datagram is one frame, a longer one is truncated
+		w->in_iov[i].iov_len = agg_mtu > 0 ? sizeof(w->in_buf[i]) : VPN_FRAME_MAX;
+		w->in_msgs[i].msg_hdr.msg_iov = &w->in_iov[i];
+		w->in_msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	w->epfd = epoll_create1(0);
+	if (w->epfd < 0){
+		perror("epoll_create1");
+		return -1;
+	}
+
+	/* the driver fds of all workers share one wait queue, wake only one */
+	ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+	ev.data.fd = w->tapfd;
+	if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->tapfd, &ev) < 0){
+		perror("epoll_ctl");
+		return -1;
+	}
+	ev.events = EPOLLIN;
+	ev.data.fd = w->sock;
+	if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->sock, &ev) < 0){
+		perror("epoll_ctl");
+		return -1;
+	}
+
+	w->timerfd = -1;
+	if (agg_mtu > 0){
+		w->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+		if (w->timerfd < 0){
+			perror("timerfd_create");
+			return -1;
+		}
+		ev.data.fd = w->timerfd;
+		if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->timerfd, &ev) < 0){
+			perror("epoll_ctl");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *config_path = "vpn_p2p_config.json";
+	struct worker *workers;
+	int nworkers = 1;
+	int cpus[MAX_WORKERS];
+	int ncpus = 0;
+	char *config;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "c:w:C:a:d:")) != -1){
+		switch (opt){
+		case 'c':
+			config_path = optarg;
+			break;
+		case 'w':
+			nworkers = atoi(optarg);
+			break;
+		case 'C':
+			ncpus = vpn_parse_cpus(optarg, cpus, MAX_WORKERS);
+			break;
+		case 'a':
+			agg_mtu = atoi(optarg);
+			break;
+		case 'd':
+			agg_deadline_us = atol(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-c config] [-w workers] [-C cpus] [-a mtu] [-d usec]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (agg_mtu != 0 && (agg_mtu < VPN_AGG_MTU_MIN || agg_mtu > VPN_AGG_MTU_MAX)){
+		fprintf(stderr, "the aggregate MTU is between %d and %d bytes\n", VPN_AGG_MTU_MIN, VPN_AGG_MTU_MAX);
+		return 1;
+	}
+	if (agg_deadline_us < 0){
+		fprintf(stderr, "invalid deadline\n");
+		return 1;
+	}
+
+	if (nworkers < 1 || nworkers > MAX_WORKERS){
+		fprintf(stderr, "between 1 and %d workers\n", MAX_WORKERS);
+		return 1;
+	}
+
+	config = vpn_read_file(config_path);
+	if (config == NULL){
+		fprintf(stderr, "Unable to find VPN config. Please set the config file according to README.\n");
+		return 1;
+	}
+	if (vpn_json_endpoint(vpn_json_key(config, "me"), &my_addr) != 0 ||
+	    vpn_json_endpoint(vpn_json_key(config, "peer"), &peer_addr) != 0){
+		fprintf(stderr, "invalid config %s\n", config_path);
+		return 1;
+	}
+	free(config);
+
+	printf("my address: %s:%d\n", inet_ntoa(my_addr.sin_addr), ntohs(my_addr.sin_port));
+	printf("peer address: %s:%d\n", inet_ntoa(peer_addr.sin_addr), ntohs(peer_addr.sin_port));
+
+	workers = calloc(nworkers, sizeof(*workers));
+	if (workers == NULL){
+		perror("calloc");
+		return 1;
+	}
+	for (int i = 0; i < nworkers; ++i){
+		if (worker_init(&workers[i], ncpus ? cpus[i % ncpus] : -1) != 0){
+			return 1;
+		}
+	}
+
+	signal(SIGINT, sig_int);
+	signal(SIGTERM, sig_int);
+
+	for (int i = 0; i < nworkers; ++i){
+		pthread_create(&workers[i].thread, NULL, worker_run, &workers[i]);
+	}
+
+	unsigned long tx = 0, tx_err = 0, tx_dgrams = 0, rx = 0, rx_err = 0, rx_dgrams = 0;
+	for (int i = 0; i < nworkers; ++i){
+		pthread_join(workers[i].thread, NULL);
+		tx += workers[i].tx_frames;
+		tx_err += workers[i].tx_errors;
+		tx_dgrams += workers[i].tx_datagrams;
+		rx += workers[i].rx_frames;
+		rx_err += workers[i].rx_errors;
+		rx_dgrams += workers[i].rx_datagrams;
+		if (workers[i].timerfd >= 0){
+			close(workers[i].timerfd);
+		}
+		close(workers[i].epfd);
+		close(workers[i].sock);
+		close(workers[i].tapfd);
+	}
+
+	printf("to peer: %lu frames in %lu datagrams, %lu errors\n", tx, tx_dgrams, tx_err);
+	printf("from peer: %lu frames in %lu datagrams, %lu errors\n", rx, rx_dgrams, rx_err);
+	printf("VPN_P2P exited.\n");
+
+	free(workers);
+	return 0;
+}
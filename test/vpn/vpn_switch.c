@@ -0,0 +1,542 @@
+/* gcc -O2 -pthread vpn_switch.c -o vpn_switch */
+
+/*
+ * Learning switch VPN, joins many wpantap hosts in a star.
+ *
+ *   -c config   config file (default vpn_switch_config.json)
+ *   -t          also switch the frames of the local wpantap device
+ *   -a          accept peers that are not in the config
+ *   -A seconds  forget addresses not seen for this long (default 300)
+ *
+ * Every host runs vpn_p2p (C or Python) with this switch as its peer.
+ * The switch learns which peer owns each 802.15.4 address from the source
+ * address of the MAC header. Frames to a known short or extended address
+ * go only to its owner; broadcast frames and frames to unknown addresses
+ * go to every other peer. A flooded frame is kept in one buffer that all
+ * the datagrams of its sendmmsg() point to. Aggregates (vpn_p2p -a) are
+ * split and their frames switched one by one, in the plain format.
+ *
+ * Counters are printed on Ctrl-C.
+ */
+
+/* first, it defines _GNU_SOURCE */
+#include "vpn_common.h"
+
+#include <signal.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+
+#define MAX_PEERS 256
+/* port 0 is the local wpantap device, peer i is port i + 1 */
+#define TAP_PORT 0
+#define OUT_MAX (VPN_BATCH * 16)
+#define IEEE802154_MTU 127
+#define TAP_BUF_SIZE (VPN_BATCH * WPANTAP_META_REC_SIZE(IEEE802154_MTU) + WPANTAP_META_REC_SIZE(WPANTAP_FRAME_MAX))
+
+/* forwarding database, open addressing */
+#define FDB_SIZE 4096
+
+#define MAC_ADDR_NONE 0
+#define MAC_ADDR_SHORT 2
+#define MAC_ADDR_EXTENDED 3
+#define MAC_SHORT_BROADCAST 0xffff
+#define MAC_SHORT_UNASSIGNED 0xfffe
+
+struct mac_addr {
+	int mode;
+	uint16_t pan;
+	uint64_t addr;		/* short or extended address */
+};
+
+struct fdb_entry {
+	int mode;		/* MAC_ADDR_NONE if the slot was never used */
+	uint64_t key;
+	int port;
+	uint64_t seen_ns;
+};
+
+struct peer {
+	struct sockaddr_in addr;
+	unsigned long rx, tx;
+};
+
+static struct fdb_entry fdb[FDB_SIZE];
+static struct peer peers[MAX_PEERS];
+static int npeers;
+static uint64_t aging_ns = 300 * 1000000000ULL;
+static uint64_t now;
+static int accept_peers;
+static volatile sig_atomic_t running = 1;
+
+static int sock, tapfd = -1;
+
+/* buffers of one batch, allocated once */
+static uint8_t in_buf[VPN_BATCH][VPN_AGG_MTU_MAX];
+static struct mmsghdr in_msgs[VPN_BATCH];
+static struct iovec in_iov[VPN_BATCH];
+static struct sockaddr_in in_addr[VPN_BATCH];
+static uint8_t tap_buf[TAP_BUF_SIZE];
+static struct iovec frame_iov[TAP_BUF_SIZE / sizeof(struct wpantap_meta)];
+static struct iovec agg_iov[VPN_AGG_FRAMES_MAX];
+
+static struct mmsghdr out_msgs[OUT_MAX];
+static int nout;
+static struct wpantap_meta tap_meta[VPN_BATCH];
+static struct iovec tap_iov[VPN_BATCH * 3];
+static int ntap_iov, ntap_frames;
+
+static unsigned long unicast, flooded, filtered, malformed, tap_rx, tap_tx, errors;
+
+static void sig_int(int sig)
+{
+	(void)sig;
+	running = 0;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+static uint64_t read_le(const uint8_t *p, int len)
+{
+	uint64_t v = 0;
+
+	for (int i = len - 1; i >= 0; --i){
+		v = (v << 8) | p[i];
+	}
+	return v;
+}
+
+/*
+ * Parses the addressing fields of the MAC header, returns 0 on success.
+ * The PAN ID compression bit is read with the 2003/2006 rules, which
+ * also hold for the common 2015 frames.
+ */
+static int mac_parse(const uint8_t *f, int len, struct mac_addr *dst, struct mac_addr *src)
+{
+	uint16_t fcf;
+	int pos, panid_comp;
+
+	memset(dst, 0, sizeof(*dst));
+	memset(src, 0, sizeof(*src));
+	if (len < 3){
+		return -1;
+	}
+	fcf = read_le(f, 2);
+	panid_comp = fcf & (1 << 6);
+	dst->mode = (fcf >> 10) & 3;
+	src->mode = (fcf >> 14) & 3;
+	if (dst->mode == 1 || src->mode == 1){
+		return -1;
+	}
+
+	pos = 2;
+	/* no sequence number with sequence number suppression (2015) */
+	if (((fcf >> 12) & 3) != 2 || !(fcf & (1 << 8))){
+		pos++;
+	}
+
+	if (dst->mode != MAC_ADDR_NONE){
+		int alen = dst->mode == MAC_ADDR_SHORT ? 2 : 8;
+
+		if (pos + 2 + alen > len){
+			return -1;
+		}
+		dst->pan = read_le(f + pos, 2);
+		dst->addr = read_le(f + pos + 2, alen);
+		pos += 2 + alen;
+	}
+
+	if (src->mode != MAC_ADDR_NONE){
+		int alen = src->mode == MAC_ADDR_SHORT ? 2 : 8;
+
+		if (panid_comp && dst->mode != MAC_ADDR_NONE){
+			src->pan = dst->pan;
+		}else{
+			if (pos + 2 > len){
+				return -1;
+			}
+			src->pan = read_le(f + pos, 2);
+			pos += 2;
+		}
+		if (pos + alen > len){
+			return -1;
+		}
+		src->addr = read_le(f + pos, alen);
+	}
+
+	return 0;
+}
+
+
+/* short addresses only mean something within their PAN */
+static uint64_t fdb_key(const struct mac_addr *a)
+{
+	return a->mode == MAC_ADDR_SHORT ? ((uint64_t)a->pan << 16) | a->addr : a->addr;
+}
+
+static unsigned int fdb_hash(int mode, uint64_t key)
+{
+	key ^= (uint64_t)mode << 62;
+	key *= 0x9E3779B97F4A7C15ULL;
+	return (unsigned int)(key >> 52) & (FDB_SIZE - 1);
+}
+
+/* returns the port owning the address, -1 if unknown or aged out */
+static int fdb_lookup(const struct mac_addr *a)
+{
+	uint64_t key = fdb_key(a);
+	unsigned int h = fdb_hash(a->mode, key);
+
+	for (int i = 0; i < FDB_SIZE; ++i){
+		struct fdb_entry *e = &fdb[(h + i) & (FDB_SIZE - 1)];
+
+		if (e->mode == MAC_ADDR_NONE){
+			return -1;
+		}
+		if (e->mode == a->mode && e->key == key){
+			return now - e->seen_ns < aging_ns ? e->port : -1;
+		}
+	}
+	return -1;
+}
+
+static void fdb_learn(const struct mac_addr *a, int port)
+{
+	uint64_t key = fdb_key(a);
+	unsigned int h = fdb_hash(a->mode, key);
+	struct fdb_entry *reuse = NULL;
+
+	for (int i = 0; i < FDB_SIZE; ++i){
+		struct fdb_entry *e = &fdb[(h + i) & (FDB_SIZE - 1)];
+
+		if (e->mode == a->mode && e->key == key){
+			reuse = e;
+			break;
+		}
+		if (reuse == NULL && e->mode != MAC_ADDR_NONE && now - e->seen_ns >= aging_ns){
+			reuse = e;
+		}
+		if (e->mode == MAC_ADDR_NONE){
+			if (reuse == NULL){
+				reuse = e;
+			}
+			break;
+		}
+	}
+
+	/* the table is full of live entries, the frames get flooded */
+	if (reuse == NULL){
+		return;
+	}
+	reuse->mode = a->mode;
+	reuse->key = key;
+	reuse->port = port;
+	reuse->seen_ns = now;
+}
+
+
+static int peer_find(const struct sockaddr_in *sa)
+{
+	for (int i = 0; i < npeers; ++i){
+		if (peers[i].addr.sin_addr.s_addr == sa->sin_addr.s_addr &&
+		    peers[i].addr.sin_port == sa->sin_port){
+			return i;
+		}
+	}
+
+	if (accept_peers && npeers < MAX_PEERS){
+		peers[npeers].addr = *sa;
+		printf("new peer %s:%d\n", inet_ntoa(sa->sin_addr), ntohs(sa->sin_port));
+		return npeers++;
+	}
+	return -1;
+}
+
+
+static void flush_out(void)
+{
+	int sent = 0;
+
+	while (sent < nout){
+		int n = sendmmsg(sock, out_msgs + sent, nout - sent, 0);
+
+		if (n <= 0){
+			errors += nout - sent;
+			break;
+		}
+		sent += n;
+	}
+	nout = 0;
+}
+
+static void flush_tap(void)
+{
+	if (ntap_frames > 0){
+		if (writev(tapfd, tap_iov, ntap_iov) < 0){
+			errors += ntap_frames;
+		}else{
+			tap_tx += ntap_frames;
+		}
+	}
+	ntap_iov = ntap_frames = 0;
+}
+
+/* queues the frame (with FCS) in iov toward port */
+static void output(int port, struct iovec *iov)
+{
+	if (port == TAP_PORT){
+		if (tapfd < 0){
+			return;
+		}
+		if (ntap_frames == VPN_BATCH){
+			flush_tap();
+		}
+		int used = vpn_meta_iov(&tap_iov[ntap_iov], &tap_meta[ntap_frames], iov->iov_base, iov->iov_len);
+		if (used > 0){
+			ntap_iov += used;
+			ntap_frames++;
+		}
+		return;
+	}
+
+	if (nout == OUT_MAX){
+		flush_out();
+	}
+	memset(&out_msgs[nout], 0, sizeof(out_msgs[nout]));
+	out_msgs[nout].msg_hdr.msg_name = &peers[port - 1].addr;
+	out_msgs[nout].msg_hdr.msg_namelen = sizeof(peers[port - 1].addr);
+	out_msgs[nout].msg_hdr.msg_iov = iov;
+	out_msgs[nout].msg_hdr.msg_iovlen = 1;
+	nout++;
+	peers[port - 1].tx++;
+}
+
+/* forwards one frame (with FCS) that came in on port in_port */
+static void switch_frame(int in_port, struct iovec *iov)
+{
+	struct mac_addr dst, src;
+	int out_port = -1;
+
+	if (mac_parse(iov->iov_base, (int)iov->iov_len - VPN_FCS_LEN, &dst, &src) != 0){
+		malformed++;
+		return;
+	}
+
+	if (src.mode == MAC_ADDR_EXTENDED ||
+	    (src.mode == MAC_ADDR_SHORT && src.addr != MAC_SHORT_BROADCAST && src.addr != MAC_SHORT_UNASSIGNED)){
+		fdb_learn(&src, in_port);
+	}
+
+	if (dst.mode == MAC_ADDR_EXTENDED ||
+	    (dst.mode == MAC_ADDR_SHORT && dst.addr != MAC_SHORT_BROADCAST)){
+		out_port = fdb_lookup(&dst);
+	}
+
+	if (out_port == in_port){
+		filtered++;
+		return;
+	}
+	if (out_port >= 0){
+		output(out_port, iov);
+		unicast++;
+		return;
+	}
+
+	for (int port = 0; port <= npeers; ++port){
+		if (port != in_port){
+			output(port, iov);
+		}
+	}
+	flooded++;
+}
+
+
+static void net_input(void)
+{
+	int received = recvmmsg(sock, in_msgs, VPN_BATCH, MSG_DONTWAIT, NULL);
+
+	now = now_ns();
+	for (int i = 0; i < received; ++i){
+		int peer = peer_find(&in_addr[i]);
+		int n;
+
+		if (peer < 0 || (in_msgs[i].msg_hdr.msg_flags & MSG_TRUNC) || in_msgs[i].msg_len <= VPN_FCS_LEN){
+			malformed++;
+			continue;
+		}
+		peers[peer].rx++;
+
+		n = vpn_agg_parse(in_buf[i], in_msgs[i].msg_len, agg_iov, VPN_AGG_FRAMES_MAX);
+		if (n > 0){
+			for (int j = 0; j < n; ++j){
+				switch_frame(peer + 1, &agg_iov[j]);
+			}
+			/* the queued datagrams point into agg_iov, the next aggregate reuses it */
+			flush_out();
+			continue;
+		}
+		if (in_msgs[i].msg_len > VPN_FRAME_MAX){
+			malformed++;
+			continue;
+		}
+
+		/* the length of this datagram only, the buffer stays the same */
+		frame_iov[i].iov_base = in_buf[i];
+		frame_iov[i].iov_len = in_msgs[i].msg_len;
+		switch_frame(peer + 1, &frame_iov[i]);
+	}
+
+	flush_out();
+	flush_tap();
+
+	for (int i = 0; i < VPN_BATCH; ++i){
+		in_msgs[i].msg_hdr.msg_namelen = sizeof(in_addr[i]);
+	}
+}
+
+static void tap_input(void)
+{
+	ssize_t bytes = read(tapfd, tap_buf, sizeof(tap_buf));
+	uint8_t *p = tap_buf;
+	int n = 0;
+
+	if (bytes <= 0){
+		return;
+	}
+
+	now = now_ns();
+	while (p < tap_buf + bytes){
+		struct wpantap_meta *meta = (struct wpantap_meta *)p;
+
+		frame_iov[n].iov_base = p + sizeof(*meta);
+		frame_iov[n].iov_len = meta->len;
+		tap_rx++;
+		switch_frame(TAP_PORT, &frame_iov[n]);
+		n++;
+		p += WPANTAP_META_REC_SIZE(meta->len);
+	}
+
+	flush_out();
+}
+
+
+int main(int argc, char *argv[])
+{
+	const char *config_path = "vpn_switch_config.json";
+	struct sockaddr_in my_addr;
+	struct epoll_event ev, events[2];
+	const char *list, *item;
+	int use_tap = 0;
+	char *config;
+	int epfd, opt;
+
+	while ((opt = getopt(argc, argv, "c:taA:")) != -1){
+		switch (opt){
+		case 'c':
+			config_path = optarg;
+			break;
+		case 't':
+			use_tap = 1;
+			break;
+		case 'a':
+			accept_peers = 1;
+			break;
+		case 'A':
+			aging_ns = strtoull(optarg, NULL, 10) * 1000000000ULL;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-c config] [-t] [-a] [-A seconds]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	config = vpn_read_file(config_path);
+	if (config == NULL){
+		fprintf(stderr, "Unable to find VPN config. Please set the config file according to README.\n");
+		return 1;
+	}
+	if (vpn_json_endpoint(vpn_json_key(config, "me"), &my_addr) != 0){
+		fprintf(stderr, "invalid config %s\n", config_path);
+		return 1;
+	}
+	list = vpn_json_key(config, "peers");
+	for (int i = 0; list && (item = vpn_json_index(list, i)) != NULL; ++i){
+		if (npeers == MAX_PEERS || vpn_json_endpoint(item, &peers[npeers].addr) != 0){
+			fprintf(stderr, "invalid peer %d in %s\n", i, config_path);
+			return 1;
+		}
+		npeers++;
+	}
+	free(config);
+
+	printf("my address: %s:%d, %d peers\n", inet_ntoa(my_addr.sin_addr), ntohs(my_addr.sin_port), npeers);
+
+	sock = vpn_open_udp(&my_addr);
+	if (sock < 0){
+		perror("unable to bind UDP socket");
+		return 1;
+	}
+	if (use_tap){
+		tapfd = vpn_open_tap();
+		if (tapfd < 0){
+			perror("unable to open wpantap device");
+			return 1;
+		}
+	}
+
+	for (int i = 0; i < VPN_BATCH; ++i){
+		in_iov[i].iov_base = in_buf[i];
+		in_iov[i].iov_len = sizeof(in_buf[i]);
+		in_msgs[i].msg_hdr.msg_iov = &in_iov[i];
+		in_msgs[i].msg_hdr.msg_iovlen = 1;
+		in_msgs[i].msg_hdr.msg_name = &in_addr[i];
+		in_msgs[i].msg_hdr.msg_namelen = sizeof(in_addr[i]);
+	}
+
+	epfd = epoll_create1(0);
+	ev.events = EPOLLIN;
+	ev.data.fd = sock;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, sock, &ev);
+	if (tapfd >= 0){
+		ev.data.fd = tapfd;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, tapfd, &ev);
+	}
+
+	signal(SIGINT, sig_int);
+	signal(SIGTERM, sig_int);
+
+	while (running){
+		int n = epoll_wait(epfd, events, 2, 200);
+
+		for (int i = 0; i < n; ++i){
+			if (events[i].data.fd == sock){
+				net_input();
+			}else{
+				tap_input();
+			}
+		}
+	}
+
+	for (int i = 0; i < npeers; ++i){
+		printf("peer %s:%d: rx %lu tx %lu\n", inet_ntoa(peers[i].addr.sin_addr),
+			ntohs(peers[i].addr.sin_port), peers[i].rx, peers[i].tx);
+	}
+	if (tapfd >= 0){
+		printf("wpantap: rx %lu tx %lu\n", tap_rx, tap_tx);
+		close(tapfd);
+	}
+	printf("unicast %lu flooded %lu filtered %lu malformed %lu errors %lu\n",
+		unicast, flooded, filtered, malformed, errors);
+	printf("VPN_SWITCH exited.\n");
+
+	close(epfd);
+	close(sock);
+	return 0;
+}
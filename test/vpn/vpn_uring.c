@@ -0,0 +1,379 @@
+/* gcc -O2 vpn_uring.c -o vpn_uring -luring */
+
+/*
+ * P2P VPN on io_uring (liburing 2.6 or later, Linux 6.7 or later), same
+ * config file and wire format as vpn_p2p. The 6.7 requirement is for the
+ * multishot read, the wpantap module itself builds from Linux 4.15 up.
+ *
+ *   -c config   config file (default vpn_p2p_config.json)
+ *   -f fds      driver fds served by the thread (default 4)
+ *
+ * A single thread keeps a multishot read armed on every driver fd and a
+ * multishot recv on the socket, so no request is submitted again while
+ * traffic flows. The kernel picks the buffers from two provided buffer
+ * rings:
+ *
+ *   - driver reads land in whole buffers of WPANTAP_FMT_META records, each
+ *     frame is sent straight from there; the buffer goes back to its ring
+ *     when its last send completes.
+ *   - datagrams land in slots of an arena registered as a fixed buffer,
+ *     one record header past the start of the slot. The header and the
+ *     padding are filled in place and the slot is written to the driver
+ *     with a fixed write, then it goes back to its ring.
+ *
+ * All the completions of a round are reaped together and every request
+ * they produce is submitted by the next io_uring_enter(), which also waits.
+ * The counters and the number of io_uring_enter() calls are printed on
+ * Ctrl-C.
+ */
+
+/* first, it defines _GNU_SOURCE */
+#include "vpn_common.h"
+
+#include <signal.h>
+#include <stdbool.h>
+#include <liburing.h>
+
+#define MAX_FDS 64
+#define RING_ENTRIES 1024
+#define CQ_ENTRIES 8192
+
+#define IEEE802154_MTU 127
+/* a driver read returns whole records, at least one of the longest frame */
+#define TAP_BUF_SIZE (VPN_BATCH * WPANTAP_META_REC_SIZE(IEEE802154_MTU) + WPANTAP_META_REC_SIZE(WPANTAP_FRAME_MAX))
+#define TAP_NBUFS 64
+/* a slot holds the record of the longest datagram */
+#define NET_SLOT_SIZE WPANTAP_META_REC_SIZE(VPN_FRAME_MAX)
+#define NET_NBUFS 1024
+
+#define BGID_TAP 0
+#define BGID_NET 1
+
+/* user_data: operation, driver fd index, buffer id */
+enum { OP_TAP_READ = 1, OP_SEND, OP_NET_RECV, OP_TAP_WRITE };
+#define UDATA(op, fd, bid) (((uint64_t)(op) << 32) | ((uint64_t)(fd) << 16) | (bid))
+#define UDATA_OP(u) ((int)((u) >> 32))
+#define UDATA_FD(u) ((int)(((u) >> 16) & 0xffff))
+#define UDATA_BID(u) ((int)((u) & 0xffff))
+
+static struct io_uring ring;
+static struct io_uring_buf_ring *tap_br, *net_br;
+static uint8_t *tap_bufs, *net_arena;
+/* sends still reading each driver buffer */
+static int tap_pending[TAP_NBUFS];
+static int tap_free = TAP_NBUFS, net_free = NET_NBUFS;
+
+static int tapfds[MAX_FDS];
+static bool tap_armed[MAX_FDS];
+static int nfds = 4;
+static int sock;
+static bool net_armed;
+static int next_tap;
+
+static unsigned long tx_frames, tx_errors, rx_frames, rx_errors, enters;
+static volatile sig_atomic_t running = 1;
+
+static void sig_int(int sig)
+{
+	(void)sig;
+	running = 0;
+}
+
+static struct io_uring_sqe *get_sqe(void)
+{
+	struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+
+	/* the submission queue is full, flush it without waiting */
+	while (sqe == NULL){
+		io_uring_submit(&ring);
+		enters++;
+		sqe = io_uring_get_sqe(&ring);
+	}
+	return sqe;
+}
+
+static void tap_recycle(int bid)
+{
+	io_uring_buf_ring_add(tap_br, tap_bufs + (size_t)bid * TAP_BUF_SIZE, TAP_BUF_SIZE,
+		bid, io_uring_buf_ring_mask(TAP_NBUFS), 0);
+	io_uring_buf_ring_advance(tap_br, 1);
+	tap_free++;
+}
+
+static void net_recycle(int bid)
+{
+	io_uring_buf_ring_add(net_br, net_arena + (size_t)bid * NET_SLOT_SIZE + sizeof(struct wpantap_meta),
+		VPN_FRAME_MAX, bid, io_uring_buf_ring_mask(NET_NBUFS), 0);
+	io_uring_buf_ring_advance(net_br, 1);
+	net_free++;
+}
+
+/* multishot requests end when their buffer ring runs dry, arm them again
+ * once a buffer is back */
+static void arm(void)
+{
+	struct io_uring_sqe *sqe;
+
+	for (int i = 0; i < nfds && tap_free > 0; ++i){
+		if (tap_armed[i]){
+			continue;
+		}
+		sqe = get_sqe();
+		io_uring_prep_read_multishot(sqe, tapfds[i], 0, 0, BGID_TAP);
+		io_uring_sqe_set_data64(sqe, UDATA(OP_TAP_READ, i, 0));
+		tap_armed[i] = true;
+	}
+
+	if (!net_armed && net_free > 0){
+		sqe = get_sqe();
+		io_uring_prep_recv_multishot(sqe, sock, NULL, 0, 0);
+		sqe->flags |= IOSQE_BUFFER_SELECT;
+		sqe->buf_group = BGID_NET;
+		io_uring_sqe_set_data64(sqe, UDATA(OP_NET_RECV, 0, 0));
+		net_armed = true;
+	}
+}
+
+/* driver -> peer, one send per record of the buffer */
+static void tap_read_done(struct io_uring_cqe *cqe)
+{
+	int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+	uint8_t *p = tap_bufs + (size_t)bid * TAP_BUF_SIZE;
+	uint8_t *end = p + cqe->res;
+	int sends = 0;
+
+	tap_free--;
+
+	while (p < end){
+		struct wpantap_meta *meta = (struct wpantap_meta *)p;
+		struct io_uring_sqe *sqe = get_sqe();
+
+		io_uring_prep_send(sqe, sock, p + sizeof(*meta), meta->len, 0);
+		io_uring_sqe_set_data64(sqe, UDATA(OP_SEND, 0, bid));
+		sends++;
+		p += WPANTAP_META_REC_SIZE(meta->len);
+	}
+
+	tap_pending[bid] = sends;
+	if (sends == 0){
+		tap_recycle(bid);
+	}
+}
+
+/* peer -> driver, the slot becomes a record in place */
+static void net_recv_done(struct io_uring_cqe *cqe)
+{
+	int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+	uint8_t *slot = net_arena + (size_t)bid * NET_SLOT_SIZE;
+	struct wpantap_meta *meta = (struct wpantap_meta *)slot;
+	struct io_uring_sqe *sqe;
+	size_t rec_size;
+
+	net_free--;
+
+	if (cqe->res <= VPN_FCS_LEN){
+		rx_errors++;
+		net_recycle(bid);
+		return;
+	}
+
+	meta->tstamp_ns = 0;
+	meta->len = cqe->res - VPN_FCS_LEN;
+	meta->flags = 0;
+	rec_size = WPANTAP_META_REC_SIZE(meta->len);
+	/* the padding overwrites the FCS */
+	memset(slot + sizeof(*meta) + meta->len, 0, rec_size - sizeof(*meta) - meta->len);
+
+	/* the driver fds all feed the same phy, spread the writes over them */
+	sqe = get_sqe();
+	io_uring_prep_write_fixed(sqe, tapfds[next_tap], slot, rec_size, 0, 0);
+	io_uring_sqe_set_data64(sqe, UDATA(OP_TAP_WRITE, next_tap, bid));
+	next_tap = (next_tap + 1) % nfds;
+}
+
+static void handle(struct io_uring_cqe *cqe)
+{
+	uint64_t udata = io_uring_cqe_get_data64(cqe);
+	int bid = UDATA_BID(udata);
+
+	switch (UDATA_OP(udata)){
+	case OP_TAP_READ:
+		if (!(cqe->flags & IORING_CQE_F_MORE)){
+			tap_armed[UDATA_FD(udata)] = false;
+		}
+		if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_BUFFER)){
+			tap_read_done(cqe);
+		}else if (cqe->res < 0 && cqe->res != -ENOBUFS){
+			fprintf(stderr, "driver read: %s\n", strerror(-cqe->res));
+		}
+		break;
+	case OP_SEND:
+		if (cqe->res < 0){
+			tx_errors++;
+		}else{
+			tx_frames++;
+		}
+		if (--tap_pending[bid] == 0){
+			tap_recycle(bid);
+		}
+		break;
+	case OP_NET_RECV:
+		if (!(cqe->flags & IORING_CQE_F_MORE)){
+			net_armed = false;
+		}
+		if (cqe->flags & IORING_CQE_F_BUFFER){
+			net_recv_done(cqe);
+		}else if (cqe->res < 0 && cqe->res != -ENOBUFS){
+			fprintf(stderr, "recv: %s\n", strerror(-cqe->res));
+		}
+		break;
+	case OP_TAP_WRITE:
+		if (cqe->res < 0){
+			rx_errors++;
+		}else{
+			rx_frames++;
+		}
+		net_recycle(bid);
+		break;
+	}
+}
+
+static int setup(void)
+{
+	struct io_uring_params params;
+	struct iovec arena;
+	int ret;
+
+	memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER;
+	params.cq_entries = CQ_ENTRIES;
+	ret = io_uring_queue_init_params(RING_ENTRIES, &ring, &params);
+	if (ret < 0){
+		fprintf(stderr, "io_uring_queue_init: %s\n", strerror(-ret));
+		return -1;
+	}
+
+	tap_bufs = aligned_alloc(4096, (size_t)TAP_NBUFS * TAP_BUF_SIZE);
+	net_arena = aligned_alloc(4096, (size_t)NET_NBUFS * NET_SLOT_SIZE);
+	if (tap_bufs == NULL || net_arena == NULL){
+		perror("aligned_alloc");
+		return -1;
+	}
+
+	/* the arena is pinned once, the writes skip the page lookups */
+	arena.iov_base = net_arena;
+	arena.iov_len = (size_t)NET_NBUFS * NET_SLOT_SIZE;
+	ret = io_uring_register_buffers(&ring, &arena, 1);
+	if (ret < 0){
+		fprintf(stderr, "io_uring_register_buffers: %s\n", strerror(-ret));
+		return -1;
+	}
+
+	tap_br = io_uring_setup_buf_ring(&ring, TAP_NBUFS, BGID_TAP, 0, &ret);
+	net_br = io_uring_setup_buf_ring(&ring, NET_NBUFS, BGID_NET, 0, &ret);
+	if (tap_br == NULL || net_br == NULL){
+		fprintf(stderr, "io_uring_setup_buf_ring: %s\n", strerror(-ret));
+		return -1;
+	}
+	tap_free = net_free = 0;
+	for (int i = 0; i < TAP_NBUFS; ++i){
+		tap_recycle(i);
+	}
+	for (int i = 0; i < NET_NBUFS; ++i){
+		net_recycle(i);
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *config_path = "vpn_p2p_config.json";
+	struct sockaddr_in my_addr, peer_addr;
+	struct io_uring_cqe *cqe;
+	unsigned int head, count;
+	char *config;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "c:f:")) != -1){
+		switch (opt){
+		case 'c':
+			config_path = optarg;
+			break;
+		case 'f':
+			nfds = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-c config] [-f fds]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (nfds < 1 || nfds > MAX_FDS){
+		fprintf(stderr, "between 1 and %d driver fds\n", MAX_FDS);
+		return 1;
+	}
+
+	config = vpn_read_file(config_path);
+	if (config == NULL){
+		fprintf(stderr, "Unable to find VPN config. Please set the config file according to README.\n");
+		return 1;
+	}
+	if (vpn_json_endpoint(vpn_json_key(config, "me"), &my_addr) != 0 ||
+	    vpn_json_endpoint(vpn_json_key(config, "peer"), &peer_addr) != 0){
+		fprintf(stderr, "invalid config %s\n", config_path);
+		return 1;
+	}
+	free(config);
+
+	printf("my address: %s:%d\n", inet_ntoa(my_addr.sin_addr), ntohs(my_addr.sin_port));
+	printf("peer address: %s:%d\n", inet_ntoa(peer_addr.sin_addr), ntohs(peer_addr.sin_port));
+
+	for (int i = 0; i < nfds; ++i){
+		tapfds[i] = vpn_open_tap();
+		if (tapfds[i] < 0){
+			perror("unable to open wpantap device");
+			return 1;
+		}
+	}
+	/* connected, the sends need no address */
+	sock = vpn_open_udp(&my_addr);
+	if (sock < 0 || connect(sock, (struct sockaddr *)&peer_addr, sizeof(peer_addr)) < 0){
+		perror("unable to set up UDP socket");
+		return 1;
+	}
+
+	if (setup() != 0){
+		return 1;
+	}
+
+	signal(SIGINT, sig_int);
+	signal(SIGTERM, sig_int);
+
+	while (running){
+		arm();
+		if (io_uring_submit_and_wait(&ring, 1) < 0){
+			continue;
+		}
+		enters++;
+
+		count = 0;
+		io_uring_for_each_cqe(&ring, head, cqe){
+			handle(cqe);
+			count++;
+		}
+		io_uring_cq_advance(&ring, count);
+	}
+
+	printf("to peer: %lu frames, %lu errors\n", tx_frames, tx_errors);
+	printf("from peer: %lu frames, %lu errors\n", rx_frames, rx_errors);
+	printf("io_uring_enter calls: %lu\n", enters);
+	printf("VPN_URING exited.\n");
+
+	io_uring_queue_exit(&ring);
+	for (int i = 0; i < nfds; ++i){
+		close(tapfds[i]);
+	}
+	close(sock);
+	return 0;
+}